@@ -166,50 +166,6 @@ class P4Exception(Exception):
         return (self.__class__, (self.value,))
 
 
-class Spec(dict):
-    """Subclass of dict, representing the fields of a spec definition.
-        
-        Attributes can be accessed either with the conventional dict format,
-        spec['attribute'] or with shorthand spec._attribute.
-        
-        Instances of this class will preventing any unknown keys.
-        """
-    def __init__(self, fieldmap=None):
-        self.__dict__['_Spec__fields'] = fieldmap
-    
-    def permitted_fields(self):
-        return self.__fields
-    
-    def __setitem__(self, key, value):
-        if not isinstance(value, str) and not isinstance(value, list):
-            raise P4Exception("Illegal value of type %s, must be string or list" % value.__class__)
-        if key in self or self.__fields == None:
-            dict.__setitem__(self, key, value)
-        elif str(key).lower() in self.__fields:
-            dict.__setitem__(self, self.__fields[key.lower()], value)
-        else:
-            raise P4Exception("Illegal field '%s'" % str(key))
-    
-    def __getattr__(self, attr):
-        key = str(attr).lower()
-        if key[0] != '_':
-            raise AttributeError(attr)
-        key = key[1:]
-        if key in self:
-            return self[key]
-        elif key in self.__fields:
-            return self[self.__fields[key]]
-    
-    def __setattr__(self, attr, value):
-        if attr == 'comment':
-            self.__dict__[attr] = value
-        else:
-            key = str(attr).lower()
-            if key[0] != '_':
-                raise AttributeError(attr)
-            key = key[1:]
-            self[key] = value
-
 #
 # P4Integration objects hold details about the integrations that have
 # been performed on a particular revision. Used primarily with the
@@ -344,6 +300,13 @@ class OutputHandler:
     HANDLED = 1
     CANCEL  = 2
     
+    # Set batch_size to more than 1 to receive tagged output in lists via
+    # outputStatBatch(). batch_interval (in seconds) limits how long a
+    # record is held back; it is checked whenever a new record arrives.
+    # Both are read when the handler is assigned to P4.handler.
+    batch_size     = 0
+    batch_interval = 0.0
+    
     def __init__(self):
         pass
     
@@ -356,6 +319,11 @@ class OutputHandler:
     def outputStat(self, h):
         return OutputHandler.REPORT
     
+    def outputStatBatch(self, hs):
+        """Return one value for the whole batch or a list with one value per record.
+           The default hands each record to outputStat()"""
+        return [ self.outputStat(h) for h in hs ]
+    
     def outputInfo(self, i):
         return OutputHandler.REPORT
     
@@ -511,6 +479,18 @@ class FilelogOutputHandler(OutputHandler):
 
 import P4API
 
+class Spec(P4API.P4Spec):
+    """Subclass of dict, representing the fields of a spec definition.
+        
+        Attributes can be accessed either with the conventional dict format,
+        spec['attribute'] or with shorthand spec._attribute.
+        
+        Instances of this class will preventing any unknown keys. The
+        fields are checked against a table shared by all specs of the
+        same spec definition; see P4API.P4Spec.
+        """
+    pass
+
 class P4(P4API.P4Adapter):
     """Use this class to communicate with a Perforce server
         
@@ -644,6 +624,7 @@ class P4(P4API.P4Adapter):
         return result[0]
     
     def __iterate(self, cmd, *args, **kargs):
+        window = kargs.pop("window", self.iterate_window)
         
         if cmd in self.specfields:
             specs = self.run(cmd, *args, **kargs)
@@ -654,12 +635,24 @@ class P4(P4API.P4Adapter):
             if cmd == 'groups':
                 specs = list({d[field]: d for d in specs}.values())
             
-            # Return a generators (Python iterator object)
-            # On iteration, this will retrieve one spec at a time
-            return ( self.run(spec, '-o', x[field])[0] for x in specs )
+            # Return a generator (Python iterator object)
+            # On iteration, this will retrieve window specs at a time
+            return self.__fetch_specs(spec, [ x[field] for x in specs ], window)
         else:
             raise Exception('Unknown spec list command: %s', cmd)
     
+    def __fetch_specs(self, spec, names, window):
+        # The specs of each window are fetched with a single pipelined run
+        # rather than one round trip each, which also bounds the number of
+        # specs held in memory.
+        window = max(1, window)
+        for i in range(0, len(names), window):
+            batch = [ (spec, '-o', name) for name in names[i:i + window] ]
+            for result in self.run_pipelined(batch, window):
+                if isinstance(result, Exception):
+                    raise result
+                yield result[0]
+    
     def __repr__(self):
         state = "disconnected"
         if self.connected():
@@ -686,11 +679,16 @@ class P4(P4API.P4Adapter):
         "Generic run method"
         context = {}
         resultLogging = True
+        iterate = False
         
         if "resultLogging" in kargs:
             resultLogging= False
             del kargs["resultLogging"]
         
+        if "iterate" in kargs:
+            iterate = kargs["iterate"]
+            del kargs["iterate"]
+        
         for (k,v) in list(kargs.items()):
             context[k] = getattr(self, k)
             setattr(self, k, v)
@@ -700,18 +698,13 @@ class P4(P4API.P4Adapter):
         if self.logger:
             self.logger.info("p4 " + " ".join(str(x) for x in flatArgs))
         
-        # if encoding is set, translate to Bytes
-        if hasattr(self,"encoding") and self.encoding and not self.encoding == 'raw':
-            result = []
-            for s in flatArgs:
-                if isinstance(s, str):
-                    result.append( s.encode(self.encoding) )
-                else:
-                    result.append(s)
-            flatArgs = result
+        flatArgs = self.__encode(flatArgs)
         
         try:
-            result = P4API.P4Adapter.run(self, *flatArgs)
+            if iterate:
+                result = P4API.P4Adapter.run_iter(self, *flatArgs)
+            else:
+                result = P4API.P4Adapter.run(self, *flatArgs)
         except P4Exception as e:
             if self.logger:
                 self.log_messages()
@@ -719,17 +712,187 @@ class P4(P4API.P4Adapter):
                 setattr( self, k, v)
             raise e
         
-        if self.logger:
+        # the results of a streamed command are not known yet
+        if self.logger and not iterate:
             self.log_messages()
         
-        if resultLogging and self.logger:
+        if resultLogging and self.logger and not iterate:
             self.logger.debug(result)
 
-        for (k,v) in list(context.items()):
-            setattr( self, k, v)
+        if context and isinstance(result, P4API.P4ResultIterator):
+            # a streamed command is still running, so its settings are
+            # only restored once it has finished or has been closed
+            result.restore_on_finish(context)
+        else:
+            for (k,v) in list(context.items()):
+                setattr( self, k, v)
                     
         return result
     
+    async def run_async(self, *args, **kargs):
+        """Runs a command without blocking the asyncio event loop.
+        
+           The command runs on a native thread; the event loop is woken up
+           through a socket whenever results are ready. Returns the same
+           list of results as run(). Cancelling the task stops the command
+           on the server.
+        """
+        result = []
+        async for item in self.run_async_iter(*args, **kargs):
+            result.append(item)
+        return result
+    
+    async def run_async_iter(self, *args, **kargs):
+        """Asynchronous version of run_iter(): yields each result as soon
+           as it has arrived, without blocking the asyncio event loop.
+        """
+        import asyncio, socket
+        
+        results = self.run_iter(*args, **kargs)
+        if not isinstance(results, P4API.P4ResultIterator):
+            # run_iter only warns when another command is still running on
+            # this connection, or when it isn't connected and exceptions
+            # are off; a coroutine must not mistake that for no results
+            if self.connected():
+                raise P4Exception("[P4.run_async()] connection busy")
+            raise P4Exception("[P4.run_async()] not connected")
+        
+        loop = asyncio.get_running_loop()
+        ready = asyncio.Event()
+        reader, writer = socket.socketpair()
+        reader.setblocking(False)
+        writer.setblocking(False)
+        
+        def wakeup():
+            try:
+                while reader.recv(4096):
+                    pass
+            except (BlockingIOError, InterruptedError):
+                pass
+            ready.set()
+        
+        loop.add_reader(reader.fileno(), wakeup)
+        try:
+            results.notify(writer.fileno())
+            while True:
+                ready.clear()
+                items = results.poll()
+                if items is None:
+                    break
+                for item in items:
+                    yield item
+                if not items:
+                    await ready.wait()
+        finally:
+            loop.remove_reader(reader.fileno())
+            # stops the command if it is still running, so nothing is
+            # written to the socket once it has been closed
+            results.close()
+            reader.close()
+            writer.close()
+    
+    def __encode(self, flatArgs):
+        # if encoding is set, translate to Bytes
+        if hasattr(self,"encoding") and self.encoding and not self.encoding == 'raw':
+            result = []
+            for s in flatArgs:
+                if isinstance(s, str):
+                    result.append( s.encode(self.encoding) )
+                else:
+                    result.append(s)
+            flatArgs = result
+        return flatArgs
+    
+    def run_pipelined(self, commands, depth=32):
+        """Runs several commands on this connection without waiting for
+           the results of one before sending the next.
+        
+           Each command is either a command name or a sequence of the
+           command name and its arguments. At most depth commands are
+           outstanding at any time. Returns a list with the result of
+           each command; a command that fails has the P4Exception it
+           would have raised as its result. Handlers, input and resolvers
+           are not used for pipelined commands.
+        """
+        batch = [ self.__encode(self.__flatten(c)) for c in commands ]
+        if self.logger:
+            for args in batch:
+                self.logger.info("p4 " + " ".join(str(x) for x in args))
+        
+        return P4API.P4Adapter.run_pipelined(self, batch, depth)
+    
+    def run_iter(self, *args, **kargs):
+        """Runs a command and returns an iterator over the results.
+        
+           Each result is handed over as soon as the server has sent it,
+           so only a bounded number of results (see iter_buffer) is held
+           in memory. Errors and warnings are raised once the iterator
+           is exhausted. No other command can be run on this connection
+           until the iterator has been exhausted or closed.
+        """
+        kargs["iterate"] = True
+        return self.run(*args, **kargs)
+    
+    # number of specs iterate_* fetches at a time, see __fetch_specs
+    iterate_window = 32
+    
+    # attributes copied to the extra connections used by run_many
+    connection_attributes = ("port", "user", "client", "password", "charset",
+                             "host", "cwd", "prog", "version", "ticket_file",
+                             "api_level", "tagged", "exception_level",
+                             "typed", "lazy_records", "stat_chunk",
+                             "spec_cache")
+
+    def run_many(self, commands, parallelism=4, ordered=True):
+        """Runs independent commands concurrently over separate connections.
+        
+           Each command is either a command name or a sequence of the
+           command name and its arguments, as passed to run(). Up to
+           parallelism connections with the settings of this one are
+           opened for the duration of the call.
+           
+           Returns a list with the result of each command in the order
+           of the commands, or if ordered is False, an iterator of
+           (index, result) tuples in order of completion. A command that
+           fails has its P4Exception as its result instead of stopping
+           the other commands.
+        """
+        if parallelism < 1:
+            raise ValueError("run_many() parallelism must be at least 1")
+        commands = [ (c,) if isinstance(c, str) else tuple(c) for c in commands ]
+        results = self.__run_many(commands, parallelism)
+        if not ordered:
+            return results
+        
+        ordered_results = [None] * len(commands)
+        for (i, result) in results:
+            ordered_results[i] = result
+        return ordered_results
+    
+    def __run_many(self, commands, parallelism):
+        workers = []
+        batch = None
+        try:
+            for i in range(min(parallelism, len(commands))):
+                # same class, so that subclasses keep their overrides
+                p4 = type(self)()
+                for attr in self.connection_attributes:
+                    value = getattr(self, attr)
+                    if value or not isinstance(value, str):
+                        setattr(p4, attr, value)
+                p4.connect()
+                workers.append(p4)
+            
+            batch = P4API.P4Batch(workers, commands)
+            for item in batch:
+                yield item
+        finally:
+            if batch is not None:
+                batch.close()
+            for p4 in workers:
+                if p4.connected():
+                    p4.disconnect()
+    
     def run_submit(self, *args, **kargs):
         "Simplified submit - if any arguments is a dict, assume it to be the changeform"
         nargs = list(args)
@@ -804,7 +967,7 @@ class P4(P4API.P4Adapter):
         result = []
         for h in raw:
             df = None
-            if isinstance( h, dict ):
+            if isinstance( h, (dict, Record) ):
                 df = processFilelog( h )
             else:
                 df = h
@@ -826,14 +989,26 @@ class P4(P4API.P4Adapter):
 
     def run_print(self, *args, **kargs):
         kargs["resultLogging"] = False
+        # Without a handler the contents of each file arrive as one object
+        assembled = kargs.get("handler", self.handler) is None
+        kargs["assemble_print"] = True
         raw = self.run('print', args, **kargs)
 
         logger = self.logger
         if "logger" in kargs:
             logger = kargs["logger"]
 
+        # Contents are assembled per header, so output without headers,
+        # as from print -q or untagged, is still joined below
+        if assembled:
+            assembled = any(isinstance(x, (dict, Record)) for x in raw or [])
+
         result = []
-        if raw:
+        if raw and assembled:
+            result = raw
+            if logger:
+                logger.debug([ x for x in raw if isinstance(x, (dict, Record)) ])
+        elif raw:
             debugResult = []
             file_contents = None
 
@@ -856,7 +1031,7 @@ class P4(P4API.P4Adapter):
                 file_contents = None
 
             for line in raw:
-                if isinstance(line, dict):
+                if isinstance(line, (dict, Record)):
                     flush_file_contents()
                     result.append(line)
                     if logger:
@@ -874,6 +1049,19 @@ class P4(P4API.P4Adapter):
 
         return result
 
+    def print_to(self, target, *args, **kargs):
+        """Runs p4 print and writes the file contents straight to disk.
+        
+           target is either a directory, below which each file is written
+           under its depot path, or a dict mapping depot paths to local
+           file names. Files are written as p4 sync would write them,
+           so text files get local line endings. Only the per-file header
+           dicts are returned; the contents of files not named by a dict
+           target are returned after their header as usual.
+        """
+        kargs["print_target"] = target
+        return self.run('print', args, **kargs)
+
     def run_resolve(self, *args, **kargs):
         if self.resolver:
             myResolver = self.resolver
@@ -1014,6 +1202,54 @@ class P4(P4API.P4Adapter):
             self.delete_client(name)
             shutil.rmtree(root)
 
+#
+# Tagged output is returned as Record instead of dict when lazy_records
+# is set. A Record is read-only and converts each value on first access.
+#
+Record = P4API.P4Record
+
+try:
+    from collections.abc import Mapping
+except ImportError:
+    from collections import Mapping
+Mapping.register(Record)
+
+class Pool(P4API.P4Pool):
+    """A fixed-size pool of connections to the same server, for use by
+       multiple threads. Connections are created on demand with the given
+       P4 attributes, stay connected between checkouts and are reconnected
+       if the server has dropped them.
+
+       Checking a connection in abandons any streamed command still
+       running on it, but nothing else is reset: attributes the borrower
+       changed, such as handler, input, exception_level, tagged or
+       client, are seen by the next thread to check it out.
+
+       with P4.Pool(4, port="ssl:perforce:1666", user="bruno") as pool:
+           with pool.connection() as p4:
+               p4.run_info()
+    """
+
+    def __init__(self, size=4, factory=None, **kargs):
+        if factory is None:
+            factory = lambda: P4(**kargs)
+        P4API.P4Pool.__init__(self, factory, size)
+
+    @contextmanager
+    def connection(self, timeout=None):
+        p4 = self.checkout(timeout)
+        try:
+            yield p4
+        finally:
+            self.checkin(p4)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+        return False
+
 class Map(P4API.P4Map):
     def __init__(self, *args):
         P4API.P4Map.__init__(self, *args)
@@ -1258,7 +1494,7 @@ if __name__ == "__main__":
     try:
         ret = p4.run(sys.argv[1:])
         for line in ret:
-            if isinstance(line, dict):
+            if isinstance(line, (dict, Record)):
                 print("-----")
                 for k in list(line.keys()):
                     print(k, "=", line[k])
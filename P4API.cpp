@@ -55,9 +55,13 @@
 #include "PythonActionMergeData.h"
 #include "P4MapMaker.h"
 #include "PythonMessage.h"
+#include "PythonRecord.h"
+#include "P4ConnectionPool.h"
+#include "P4CommandBatch.h"
 #include "PythonTypes.h"
 #include "debug.h"
 #include "PythonKeepAlive.h"
+#include "PythonThreadGuard.h"
 
 // #include <alloca.h> 
 
@@ -66,6 +70,8 @@
 #include <sstream>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 
@@ -78,10 +84,6 @@ static Ident ident = {
 // ==== P4Adapter ====
 // ===================
 
-PyObject * P4Error;
-PyObject * P4OutputHandler;
-PyObject * P4Progress;
-
 /*
  * P4Adapter destructor
  */
@@ -89,7 +91,9 @@ static void
 P4Adapter_dealloc(P4Adapter *self)
 {
     delete self->clientAPI;
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);	// instances of heap types own a reference to it
 }
 
 /*
@@ -112,6 +116,7 @@ P4Adapter_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 static int
 P4Adapter_init(P4Adapter *self, PyObject *args, PyObject *kwds)
 {
+    LockPythonObject guard( (PyObject *) self );
 
     if (kwds != NULL && PyDict_Check(kwds)) {
     	Py_ssize_t pos = 0;
@@ -169,16 +174,19 @@ P4Adapter_repr(P4Adapter *self)
 
 static PyObject * P4Adapter_connect(P4Adapter * self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->clientAPI->Connect();
 }
 
 static PyObject * P4Adapter_connected(P4Adapter * self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->clientAPI->Connected();
 }
 
 static PyObject * P4Adapter_disconnect(P4Adapter * self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->clientAPI->Disconnect();
 }
 
@@ -188,6 +196,7 @@ static PyObject * P4Adapter_disconnect(P4Adapter * self)
 //
 static PyObject * P4Adapter_env(P4Adapter * self, PyObject * var)
 {
+    LockPythonObject guard( (PyObject *) self );
     if ( !var ) Py_RETURN_NONE;
 
     const char *val = self->clientAPI->GetEnv( GetPythonString( var ) );
@@ -198,6 +207,7 @@ static PyObject * P4Adapter_env(P4Adapter * self, PyObject * var)
 
 static PyObject * P4Adapter_set_env(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * var;
     const char * val = 0; // if not provided, will reset the registry value
 
@@ -209,8 +219,9 @@ static PyObject * P4Adapter_set_env(P4Adapter * self, PyObject *args)
 }
 
 
-static PyObject * P4Adapter_run(P4Adapter * self, PyObject * args)
+static PyObject * P4Adapter_runCommand(P4Adapter * self, PyObject * args, bool iterate)
 {
+    LockPythonObject guard( (PyObject *) self );
     PyObject * cmd = PyTuple_GetItem(args, 0);
     if (cmd == NULL) {
     	return NULL;
@@ -238,10 +249,42 @@ static PyObject * P4Adapter_run(P4Adapter * self, PyObject * args)
     // the other hack is that the API expects (char * const *), but this cannot be stored
     // a std::vector<>, because it cannot exchange pointers
     
+    if( iterate )
+	return self->clientAPI->RunIter((PyObject *) self, GetPythonString(cmd),
+	    (int)argv.size(), (argv.size() > 0) ? (char * const *) &argv[0] : NULL );
+
     return self->clientAPI->Run(GetPythonString(cmd), (int)argv.size(), 
         (argv.size() > 0) ? (char * const *) &argv[0] : NULL );
 }
 
+static PyObject * P4Adapter_run(P4Adapter * self, PyObject * args)
+{
+    return P4Adapter_runCommand(self, args, false);
+}
+
+static PyObject * P4Adapter_runIter(P4Adapter * self, PyObject * args)
+{
+    return P4Adapter_runCommand(self, args, true);
+}
+
+static PyObject * P4Adapter_runPipelined(P4Adapter * self, PyObject * args)
+{
+    LockPythonObject guard( (PyObject *) self );
+    PyObject * commands;
+    int window = 32;
+
+    if( !PyArg_ParseTuple(args, "O|i", &commands, &window) )
+	return NULL;
+
+    // The depth bounds the memory and server load, so don't guess
+    if( window < 1 ) {
+	PyErr_SetString(PyExc_ValueError, "run_pipelined() depth must be at least 1");
+	return NULL;
+    }
+
+    return self->clientAPI->RunPipelined(commands, window);
+}
+
 static PyObject * P4API_identify(PyObject * self)
 {
     StrBuf	s;
@@ -315,6 +358,7 @@ static bool copy_config(ServerHelperApi * personalServer, const char * port, Cli
 
 static PyObject * P4API_dvcs_init(P4Adapter * self, PyObject * args, PyObject * keywds)
 {
+    LockPythonObject guard( (PyObject *) self );
     char * user = NULL;
     char * client = NULL;
     char * directory = (char *) ".";
@@ -370,6 +414,7 @@ static PyObject * P4API_dvcs_init(P4Adapter * self, PyObject * args, PyObject *
 
 static PyObject * P4API_dvcs_clone(P4Adapter * self, PyObject * args, PyObject * keywds)
 {
+    LockPythonObject guard( (PyObject *) self );
     char * user = NULL;
     char * client = NULL;
     char * directory = NULL;
@@ -459,6 +504,7 @@ static PyObject * P4API_dvcs_clone(P4Adapter * self, PyObject * args, PyObject *
 
 static PyObject * P4Adapter_formatSpec(P4Adapter * self, PyObject * args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * type;
     PyObject * dict;
     
@@ -477,6 +523,7 @@ static PyObject * P4Adapter_formatSpec(P4Adapter * self, PyObject * args)
 
 static PyObject * P4Adapter_parseSpec(P4Adapter * self, PyObject * args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * type;
     const char * form;
     
@@ -489,6 +536,7 @@ static PyObject * P4Adapter_parseSpec(P4Adapter * self, PyObject * args)
 
 static PyObject * P4Adapter_defineSpec(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * type;
     const char * spec;
 
@@ -501,6 +549,7 @@ static PyObject * P4Adapter_defineSpec(P4Adapter * self, PyObject *args)
 
 static PyObject * P4Adapter_protocol(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * var;
     const char * val = 0;
 
@@ -518,6 +567,7 @@ static PyObject * P4Adapter_protocol(P4Adapter * self, PyObject *args)
 
 static PyObject * P4Adapter_isIgnored(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * var;
 
     if ( PyArg_ParseTuple(args, "s", &var)) {
@@ -529,12 +579,14 @@ static PyObject * P4Adapter_isIgnored(P4Adapter * self, PyObject *args)
 
 static PyObject * P4Adapter_disableTmpCleanup(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
 
     return self->clientAPI->DisableTmpCleanup();
 }
 
 static PyObject * P4Adapter_setTunable(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char *tunable;
     const char *value;
 
@@ -567,6 +619,7 @@ static PyObject * P4Adapter_setTunable(P4Adapter * self, PyObject *args)
 
 static PyObject * P4Adapter_getTunable(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char *tunable;
 
     if( PyArg_ParseTuple(args, "s", &tunable)) {
@@ -592,6 +645,7 @@ static PyObject * P4Adapter_getTunable(P4Adapter * self, PyObject *args)
 // ==================
 
 static PyObject* P4Adapter_setBreak(P4Adapter* self, PyObject* args) {
+    LockPythonObject guard( (PyObject *) self );
     PyObject* py_callable;
 
     // Parse the arguments
@@ -616,6 +670,7 @@ static PyObject* P4Adapter_setBreak(P4Adapter* self, PyObject* args) {
 
 static PyObject * P4Adapter_convert(P4Adapter * self, PyObject *args)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * charset;
     PyObject * content;
 
@@ -641,6 +696,10 @@ static PyMethodDef P4Adapter_methods[] = {
      "Set values in the registry (if available on the platform) for the Perforce environment"},
     {"run", (PyCFunction)P4Adapter_run, METH_VARARGS,
      "Runs a command"},
+    {"run_iter", (PyCFunction)P4Adapter_runIter, METH_VARARGS,
+     "Runs a command and returns an iterator over its results"},
+    {"run_pipelined", (PyCFunction)P4Adapter_runPipelined, METH_VARARGS,
+     "Runs several commands without waiting for each one's results"},
     {"format_spec", (PyCFunction)P4Adapter_formatSpec, METH_VARARGS,
      "Converts a dictionary-based form into a string"},
     {"parse_spec", (PyCFunction)P4Adapter_parseSpec, METH_VARARGS,
@@ -675,6 +734,7 @@ static PyMemberDef P4Adapter_members[] = {
 
 static PyObject * P4Adapter_getattro(P4Adapter *self, PyObject * nameObject) 
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * name = GetPythonString(nameObject);
     
     PythonClientAPI::intgetter igetter = self->clientAPI->GetIntGetter(name);
@@ -697,6 +757,7 @@ static PyObject * P4Adapter_getattro(P4Adapter *self, PyObject * nameObject)
 
 static int P4Adapter_setattro(P4Adapter *self, PyObject * nameObject, PyObject * value)
 {
+    LockPythonObject guard( (PyObject *) self );
     const char * name = GetPythonString(nameObject);
 
     // Special case first: 
@@ -758,45 +819,25 @@ static int P4Adapter_setattro(P4Adapter *self, PyObject * nameObject, PyObject *
 }
 
 /* PyObject object for the P4Adapter */
-static PyTypeObject P4AdapterType = {
-    PyVarObject_HEAD_INIT(&PyType_Type, 0)
-    "P4API.P4Adapter",				/* name */
-    sizeof(P4Adapter),				/* basicsize */
-    0,           				/* itemsize */
-    (destructor) P4Adapter_dealloc,		/* dealloc */
-    0,           				/* print */
-    0,						/* getattr */
-    0,						/* setattr */
-    0,           				/* compare */
-    (reprfunc) P4Adapter_repr,   		/* repr */
-    0,           				/* number methods */
-    0,           				/* sequence methods */
-    0,           				/* mapping methods */
-    0,                         			/* tp_hash */
-    0,                         			/* tp_call*/
-    0,                         			/* tp_str*/
-    (getattrofunc) P4Adapter_getattro, 		/* tp_getattro*/
-    (setattrofunc) P4Adapter_setattro,		/* tp_setattro*/
-    0,                         			/* tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,	/* tp_flags*/
-    "P4Adapter - base class for P4",		/* tp_doc */
-    0,		               			/* tp_traverse */
-    0,		               			/* tp_clear */
-    0,		               			/* tp_richcompare */
-    0,		               			/* tp_weaklistoffset */
-    0,		               			/* tp_iter */
-    0,		               			/* tp_iternext */
-    P4Adapter_methods,             		/* tp_methods */
-    P4Adapter_members,             		/* tp_members */
-    0,                         			/* tp_getset */
-    0,                         			/* tp_base */
-    0,                         			/* tp_dict */
-    0,                         			/* tp_descr_get */
-    0,                         			/* tp_descr_set */
-    0,                         			/* tp_dictoffset */
-    (initproc)P4Adapter_init,      		/* tp_init */
-    0,                         			/* tp_alloc */
-    P4Adapter_new,                 		/* tp_new */
+static PyType_Slot P4Adapter_slots[] = {
+    {Py_tp_dealloc, (void *) P4Adapter_dealloc},
+    {Py_tp_repr, (void *) P4Adapter_repr},
+    {Py_tp_getattro, (void *) P4Adapter_getattro},
+    {Py_tp_setattro, (void *) P4Adapter_setattro},
+    {Py_tp_doc, (void *) "P4Adapter - base class for P4"},
+    {Py_tp_methods, (void *) P4Adapter_methods},
+    {Py_tp_members, (void *) P4Adapter_members},
+    {Py_tp_init, (void *) P4Adapter_init},
+    {Py_tp_new, (void *) P4Adapter_new},
+    {0, 0}
+};
+
+static PyType_Spec P4Adapter_spec = {
+    "P4API.P4Adapter",
+    sizeof(P4Adapter),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    P4Adapter_slots
 };
 
 // =====================
@@ -809,7 +850,9 @@ static PyTypeObject P4AdapterType = {
 static void P4MergeData_dealloc(P4MergeData *self)
 {
     delete self->mergeData;
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
 }
 
 static PyObject * P4MergeData_repr(P4MergeData *self)
@@ -867,45 +910,21 @@ static PyObject * P4MergeData_getattro(P4MergeData * self, PyObject * nameObject
 }
 
 /* PyObject object for the P4MergeData */
-PyTypeObject P4MergeDataType = {
-    PyVarObject_HEAD_INIT(&PyType_Type, 0)
-    "P4API.P4MergeData",                        /* name */
-    sizeof(P4MergeData),                        /* basicsize */
-    0,                                          /* itemsize */
-    (destructor) P4MergeData_dealloc,           /* dealloc */
-    0,                                          /* print */
-    0,                                          /* getattr */
-    0,                                          /* setattr */
-    0,                                          /* compare */
-    (reprfunc) P4MergeData_repr,                /* repr */
-    0,                                          /* number methods */
-    0,                                          /* sequence methods */
-    0,                                          /* mapping methods */
-    0,                                          /* tp_hash */
-    0,                                          /* tp_call*/
-    0,                                          /* tp_str*/
-    (getattrofunc) P4MergeData_getattro,        /* tp_getattro*/
-    0,                                          /* tp_setattro*/
-    0,                                          /* tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,                         /* tp_flags*/
-    "P4MergeData - contains merge information for resolve",            /* tp_doc */
-    0,                                          /* tp_traverse */
-    0,                                          /* tp_clear */
-    0,                                          /* tp_richcompare */
-    0,                                          /* tp_weaklistoffset */
-    0,                                          /* tp_iter */
-    0,                                          /* tp_iternext */
-    P4MergeData_methods,                          /* tp_methods */
-    0,                                          /* tp_members */
-    0,                                          /* tp_getset */
-    0,                                          /* tp_base */
-    0,                                          /* tp_dict */
-    0,                                          /* tp_descr_get */
-    0,                                          /* tp_descr_set */
-    0,                                          /* tp_dictoffset */
-    0,                                          /* tp_init */
-    0,                                          /* tp_alloc */
-    0,                                          /* tp_new */
+static PyType_Slot P4MergeData_slots[] = {
+    {Py_tp_dealloc, (void *) P4MergeData_dealloc},
+    {Py_tp_repr, (void *) P4MergeData_repr},
+    {Py_tp_getattro, (void *) P4MergeData_getattro},
+    {Py_tp_doc, (void *) "P4MergeData - contains merge information for resolve"},
+    {Py_tp_methods, (void *) P4MergeData_methods},
+    {0, 0}
+};
+
+static PyType_Spec P4MergeData_spec = {
+    "P4API.P4MergeData",
+    sizeof(P4MergeData),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    P4MergeData_slots
 };
 
 // ===========================
@@ -918,7 +937,9 @@ PyTypeObject P4MergeDataType = {
 static void P4ActionMergeData_dealloc(P4ActionMergeData *self)
 {
     delete self->mergeData;
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
 }
 
 static PyObject * P4ActionMergeData_repr(P4ActionMergeData *self)
@@ -959,53 +980,26 @@ static PyObject * P4ActionMergeData_getattro(P4ActionMergeData * self, PyObject
 }
 
 /* PyObject object for the P4MergeData */
-PyTypeObject P4ActionMergeDataType = {
-    PyVarObject_HEAD_INIT(&PyType_Type, 0)
-    "P4API.P4ActionMergeData",                  /* name */
-    sizeof(P4ActionMergeData),                  /* basicsize */
-    0,                                          /* itemsize */
-    (destructor) P4ActionMergeData_dealloc,     /* dealloc */
-    0,                                          /* print */
-    0,                                          /* getattr */
-    0,                                          /* setattr */
-    0,                                          /* compare */
-    (reprfunc) P4ActionMergeData_repr,          /* repr */
-    0,                                          /* number methods */
-    0,                                          /* sequence methods */
-    0,                                          /* mapping methods */
-    0,                                          /* tp_hash */
-    0,                                          /* tp_call*/
-    0,                                          /* tp_str*/
-    (getattrofunc) P4ActionMergeData_getattro,  /* tp_getattro*/
-    0,                                          /* tp_setattro*/
-    0,                                          /* tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,                         /* tp_flags*/
-    "P4ActionMergeData - contains action merge information for resolve",            /* tp_doc */
-    0,                                          /* tp_traverse */
-    0,                                          /* tp_clear */
-    0,                                          /* tp_richcompare */
-    0,                                          /* tp_weaklistoffset */
-    0,                                          /* tp_iter */
-    0,                                          /* tp_iternext */
-    0,                                          /* tp_methods */
-    0,                                          /* tp_members */
-    0,                                          /* tp_getset */
-    0,                                          /* tp_base */
-    0,                                          /* tp_dict */
-    0,                                          /* tp_descr_get */
-    0,                                          /* tp_descr_set */
-    0,                                          /* tp_dictoffset */
-    0,                                          /* tp_init */
-    0,                                          /* tp_alloc */
-    0,                                          /* tp_new */
+static PyType_Slot P4ActionMergeData_slots[] = {
+    {Py_tp_dealloc, (void *) P4ActionMergeData_dealloc},
+    {Py_tp_repr, (void *) P4ActionMergeData_repr},
+    {Py_tp_getattro, (void *) P4ActionMergeData_getattro},
+    {Py_tp_doc, (void *) "P4ActionMergeData - contains action merge information for resolve"},
+    {0, 0}
+};
+
+static PyType_Spec P4ActionMergeData_spec = {
+    "P4API.P4ActionMergeData",
+    sizeof(P4ActionMergeData),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    P4ActionMergeData_slots
 };
 
 // ===============
 // ==== P4Map ====
 // ===============
 
-extern PyTypeObject P4MapType; // forward
-
 
 /*
  * P4Map destructor
@@ -1014,7 +1008,9 @@ static void
         P4Map_dealloc(P4Map *self)
 {
     delete self->map;
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
 }
 
 /*
@@ -1044,12 +1040,14 @@ static int
 static PyObject *
         P4Map_repr(P4Map *self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->map->Inspect();
 }
 
 static PyObject *
         P4Map_insert(P4Map *self, PyObject * args)
 {
+    LockPythonObject guard( (PyObject *) self );
     // expects one, or two arguments, lhs, and optional rhs. In the
     // absence of rhs, lhs is assumed to contain both halves.
     PyObject *lhs;
@@ -1075,6 +1073,7 @@ static PyObject *
 static PyObject *
         P4Map_clear(P4Map *self)
 {
+    LockPythonObject guard( (PyObject *) self );
     // clears out the map
     
     self->map->Clear();
@@ -1085,6 +1084,7 @@ static PyObject *
 static PyObject *
         P4Map_translate(P4Map *self, PyObject * args)
 {
+    LockPythonObject guard( (PyObject *) self );
     // expects two arguments, the string and the direction 
     // True (default) ==> Left to Right
     // False ==> Right to Left
@@ -1108,6 +1108,7 @@ static PyObject *
 static PyObject *
         P4Map_translateArray(P4Map *self, PyObject * args)
 {
+    LockPythonObject guard( (PyObject *) self );
     // expects two arguments, the string and the direction
     // True (default) ==> Left to Right
     // False ==> Right to Left
@@ -1131,7 +1132,13 @@ static PyObject *
 static PyObject *
         P4Map_reverse(P4Map *self)
 {
-    P4Map *	rmap = (P4Map *) P4MapType.tp_alloc(&P4MapType, 0);
+    LockPythonObject guard( (PyObject *) self );
+    P4API_state * st = P4API_GetState();
+    if( !st )
+	return NULL;
+
+    PyTypeObject * mapType = st->mapType;
+    P4Map *	rmap = (P4Map *) mapType->tp_alloc(mapType, 0);
 
     if (!rmap)
        return (PyObject *) rmap;
@@ -1145,24 +1152,28 @@ static PyObject *
 static PyObject *
         P4Map_count(P4Map *self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return PyInt_FromLong( self->map->Count() );
 }
 
 static PyObject *
         P4Map_lhs(P4Map *self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->map->Lhs();
 }
 
 static PyObject *
         P4Map_rhs(P4Map *self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->map->Rhs();
 }
 
 static PyObject *
         P4Map_as_array(P4Map *self)
 {
+    LockPythonObject guard( (PyObject *) self );
     return self->map->ToA();
 }
 
@@ -1175,7 +1186,12 @@ static PyObject *
     P4Map *right;
     P4Map *result;
     
-    int ok = PyArg_ParseTuple(args, "O!O!", &P4MapType, (PyObject **) &left, &P4MapType, (PyObject **) &right);
+    P4API_state * st = P4API_GetState();
+    if( !st )
+	return NULL;
+
+    PyTypeObject * mapType = st->mapType;
+    int ok = PyArg_ParseTuple(args, "O!O!", mapType, (PyObject **) &left, mapType, (PyObject **) &right);
     if (!ok) 
     	return NULL;
     
@@ -1218,45 +1234,22 @@ static PyMethodDef P4Map_methods[] = {
 };
 
 /* PyObject object for the P4MergeData */
-PyTypeObject P4MapType = {
-    PyVarObject_HEAD_INIT(&PyType_Type, 0)
-            "P4API.P4Map",                               /* name */
-            sizeof(P4Map),                              /* basicsize */
-            0,                                          /* itemsize */
-            (destructor) P4Map_dealloc,                 /* dealloc */
-            0,                                          /* print */
-            0,                                          /* getattr */
-            0,                                          /* setattr */
-            0,                                          /* compare */
-            (reprfunc) P4Map_repr,                      /* repr */
-            0,                                          /* number methods */
-            0,                                          /* sequence methods */
-            0,                                          /* mapping methods */
-            0,                                          /* tp_hash */
-            0,                                          /* tp_call*/
-            0,                                          /* tp_str*/
-            0,                                          /* tp_getattro*/
-            0,                                          /* tp_setattro*/
-            0,                                          /* tp_as_buffer*/
-            Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,   /* tp_flags*/
-            "P4Map - client mapping interface",         /* tp_doc */
-            0,                                          /* tp_traverse */
-            0,                                          /* tp_clear */
-            0,                                          /* tp_richcompare */
-            0,                                          /* tp_weaklistoffset */
-            0,                                          /* tp_iter */
-            0,                                          /* tp_iternext */
-            P4Map_methods,                              /* tp_methods */
-            0,                                          /* tp_members */
-            0,                                          /* tp_getset */
-            0,                                          /* tp_base */
-            0,                                          /* tp_dict */
-            0,                                          /* tp_descr_get */
-            0,                                          /* tp_descr_set */
-            0,                                          /* tp_dictoffset */
-            (initproc) P4Map_init,                      /* tp_init */
-            0,                                          /* tp_alloc */
-            P4Map_new,                                  /* tp_new */
+static PyType_Slot P4Map_slots[] = {
+    {Py_tp_dealloc, (void *) P4Map_dealloc},
+    {Py_tp_repr, (void *) P4Map_repr},
+    {Py_tp_doc, (void *) "P4Map - client mapping interface"},
+    {Py_tp_methods, (void *) P4Map_methods},
+    {Py_tp_init, (void *) P4Map_init},
+    {Py_tp_new, (void *) P4Map_new},
+    {0, 0}
+};
+
+static PyType_Spec P4Map_spec = {
+    "P4API.P4Map",
+    sizeof(P4Map),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    P4Map_slots
 };
 
 // ===================
@@ -1278,7 +1271,9 @@ static void
 P4Message_dealloc(P4Message *self)
 {
     delete self->msg;
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
 }
 
 static PyObject *
@@ -1324,191 +1319,1343 @@ P4Message_getattro(P4Message * self, PyObject * nameObject)
 	return PyObject_GenericGetAttr((PyObject *) self, nameObject);
 }
 
-PyTypeObject P4MessageType =
-{
-    PyVarObject_HEAD_INIT(&PyType_Type, 0)
-	    "P4API.P4Message",                          /* name */
-	    sizeof(P4Message),                          /* basicsize */
-	    0,                                          /* itemsize */
-	    (destructor) P4Message_dealloc,             /* dealloc */
-	    0,                                          /* print */
-	    0,                                          /* getattr */
-	    0,                                          /* setattr */
-	    0,                                          /* compare */
-	    (reprfunc) P4Message_repr,                  /* repr */
-	    0,                                          /* number methods */
-	    0,                                          /* sequence methods */
-	    0,                                          /* mapping methods */
-	    0,                                          /* tp_hash */
-	    0,                                          /* tp_call*/
-	    (reprfunc) P4Message_str,                   /* tp_str*/
-	    (getattrofunc) P4Message_getattro,          /* tp_getattro*/
-	    0,                                          /* tp_setattro*/
-	    0,                                          /* tp_as_buffer*/
-	    Py_TPFLAGS_DEFAULT,                         /* tp_flags*/
-	    "P4Message - errors and warnings",          /* tp_doc */
-	    0,                                          /* tp_traverse */
-	    0,                                          /* tp_clear */
-	    0,                                          /* tp_richcompare */
-	    0,                                          /* tp_weaklistoffset */
-	    0,                                          /* tp_iter */
-	    0,                                          /* tp_iternext */
-	    P4Message_methods,                          /* tp_methods */
-	    0,                                          /* tp_members */
-	    0,                                          /* tp_getset */
-	    0,                                          /* tp_base */
-	    0,                                          /* tp_dict */
-	    0,                                          /* tp_descr_get */
-	    0,                                          /* tp_descr_set */
-	    0,                                          /* tp_dictoffset */
-	    (initproc) P4Message_init,                  /* tp_init */
-	    0,                                          /* tp_alloc */
-	    P4Message_new,                              /* tp_new */
+static PyType_Slot P4Message_slots[] = {
+    {Py_tp_dealloc, (void *) P4Message_dealloc},
+    {Py_tp_repr, (void *) P4Message_repr},
+    {Py_tp_str, (void *) P4Message_str},
+    {Py_tp_getattro, (void *) P4Message_getattro},
+    {Py_tp_doc, (void *) "P4Message - errors and warnings"},
+    {Py_tp_methods, (void *) P4Message_methods},
+    {Py_tp_init, (void *) P4Message_init},
+    {Py_tp_new, (void *) P4Message_new},
+    {0, 0}
 };
 
+static PyType_Spec P4Message_spec = {
+    "P4API.P4Message",
+    sizeof(P4Message),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    P4Message_slots
+};
 
-// ===============
-// ==== P4API ====
-// ===============
 
-struct P4API_state {
-        PyObject * error;
+// ==========================
+// ==== P4ResultIterator ====
+// ==========================
+
+static PythonClientAPI * P4ResultIterator_api(P4ResultIterator *self)
+{
+    return ((P4Adapter *) self->adapter)->clientAPI;
+}
+
+//
+// Restores the attributes that P4.run() set for the streamed command.
+// Called once the command has finished, so they stay in effect for the
+// whole command. An exception already set is kept; returns -1 if an
+// exception is set afterwards.
+//
+
+static int
+P4ResultIterator_restore(P4ResultIterator *self)
+{
+    PyObject * context = self->context;
+    self->context = NULL;
+
+    PyObject *type, *value, *tb;
+    PyErr_Fetch(&type, &value, &tb);
+
+    if( context ) {
+	PyObject *key, *val;
+	Py_ssize_t pos = 0;
+	while( PyDict_Next(context, &pos, &key, &val) ) {
+	    if( PyObject_SetAttr(self->adapter, key, val) == 0 )
+		continue;
+
+	    if( type )
+		PyErr_WriteUnraisable((PyObject *) self);
+	    else
+		PyErr_Fetch(&type, &value, &tb);
+	}
+	Py_DECREF(context);
+    }
+
+    PyErr_Restore(type, value, tb);
+    return type ? -1 : 0;
+}
+
+static void
+P4ResultIterator_dealloc(P4ResultIterator *self)
+{
+    // Do not lose an exception that may be in flight
+
+    PyObject *type, *value, *tb;
+    PyErr_Fetch(&type, &value, &tb);
+
+    {
+	LockPythonObject guard( self->adapter );
+
+	PyObject * result = P4ResultIterator_api(self)->IterClose(self->id);
+	if( result )
+	    Py_DECREF(result);
+	else
+	    PyErr_WriteUnraisable((PyObject *) self);
+    }
+
+    if( P4ResultIterator_restore(self) < 0 )
+	PyErr_WriteUnraisable((PyObject *) self);
+
+    PyErr_Restore(type, value, tb);
+
+    Py_DECREF(self->adapter);
+    PyTypeObject * tp = Py_TYPE(self);
+    PyObject_Del(self);
+    Py_DECREF(tp);
+}
+
+static PyObject *
+P4ResultIterator_iter(P4ResultIterator *self)
+{
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *
+P4ResultIterator_iternext(P4ResultIterator *self)
+{
+    PyObject * item;
+    {
+	LockPythonObject guard( self->adapter );
+	// NULL without an exception set signals StopIteration
+	item = P4ResultIterator_api(self)->IterNext(self->id);
+    }
+
+    if( !item )
+	P4ResultIterator_restore(self);
+
+    return item;
+}
+
+static PyObject *
+P4ResultIterator_close(P4ResultIterator *self)
+{
+    PyObject * result;
+    {
+	LockPythonObject guard( self->adapter );
+	result = P4ResultIterator_api(self)->IterClose(self->id);
+    }
+
+    if( P4ResultIterator_restore(self) < 0 )
+	Py_CLEAR(result);
+
+    return result;
+}
+
+static PyObject *
+P4ResultIterator_restoreOnFinish(P4ResultIterator *self, PyObject *args)
+{
+    PyObject * context;
+    if( !PyArg_ParseTuple(args, "O!", &PyDict_Type, &context) )
+	return NULL;
+
+    Py_INCREF(context);
+    Py_XSETREF(self->context, context);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+P4ResultIterator_notify(P4ResultIterator *self, PyObject *args)
+{
+    LockPythonObject guard( self->adapter );
+    int fd;
+    if( !PyArg_ParseTuple(args, "i", &fd) )
+	return NULL;
+
+    if( P4ResultIterator_api(self)->IterNotify(self->id, fd) < 0 )
+	return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+P4ResultIterator_poll(P4ResultIterator *self)
+{
+    PyObject * items;
+    {
+	LockPythonObject guard( self->adapter );
+	items = P4ResultIterator_api(self)->IterPoll(self->id);
+    }
+
+    // None or an exception marks the end of the command
+    if( ( !items || items == Py_None ) && P4ResultIterator_restore(self) < 0 )
+	Py_CLEAR(items);
+
+    return items;
+}
+
+static PyMethodDef P4ResultIterator_methods[] = {
+    {"close", (PyCFunction)P4ResultIterator_close, METH_NOARGS,
+     "Stops the command and discards any remaining results"},
+    {"notify", (PyCFunction)P4ResultIterator_notify, METH_VARARGS,
+     "Writes a byte to the given descriptor whenever results are ready"},
+    {"poll", (PyCFunction)P4ResultIterator_poll, METH_NOARGS,
+     "Returns the results ready so far without waiting, or None at the end"},
+    {"restore_on_finish", (PyCFunction)P4ResultIterator_restoreOnFinish, METH_VARARGS,
+     "Sets the attributes of the P4 object to restore once the command has finished"},
+    {NULL}  /* Sentinel */
 };
 
-#if PY_MAJOR_VERSION >= 3
-#define GETSTATE(m) ((struct P4API_state*)PyModule_GetState(m))
-#else
-#define GETSTATE(m) (&_state)
-static struct P4API_state _state;
-#endif
+static PyType_Slot P4ResultIterator_slots[] = {
+    {Py_tp_dealloc, (void *) P4ResultIterator_dealloc},
+    {Py_tp_doc, (void *) "P4ResultIterator - streamed command results"},
+    {Py_tp_iter, (void *) P4ResultIterator_iter},
+    {Py_tp_iternext, (void *) P4ResultIterator_iternext},
+    {Py_tp_methods, (void *) P4ResultIterator_methods},
+    {0, 0}
+};
 
-static struct PyMethodDef P4API_methods[] = {
-    {"identify", (PyCFunction)P4API_identify, METH_NOARGS, "Identify module version"},
-    {"dvcs_init", (PyCFunction)P4API_dvcs_init, METH_VARARGS | METH_KEYWORDS, "Initialize local server"},
-    {"dvcs_clone", (PyCFunction)P4API_dvcs_clone, METH_VARARGS | METH_KEYWORDS, "Clone local server"},
-    {NULL} /* Sentinel */
+static PyType_Spec P4ResultIterator_spec = {
+    "P4API.P4ResultIterator",
+    sizeof(P4ResultIterator),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    P4ResultIterator_slots
 };
 
-// ===================
-// ==== initP4API ====
-// ===================
 
-#if PY_MAJOR_VERSION >= 3
+// ==================
+// ==== P4Record ====
+// ==================
 
-static int P4API_traverse(PyObject *m, visitproc visit, void *arg) {
-    Py_VISIT(GETSTATE(m)->error);
-    return 0;
+static void
+P4Record_dealloc(P4Record *self)
+{
+    delete self->rec;
+    PyTypeObject * tp = Py_TYPE(self);
+    PyObject_Del(self);
+    Py_DECREF(tp);
 }
 
-static int P4API_clear(PyObject *m) {
-    Py_CLEAR(GETSTATE(m)->error);
-    return 0;
+static Py_ssize_t
+P4Record_length(P4Record *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    return self->rec->Length();
 }
 
-static struct PyModuleDef P4API_moduledef = {
-        PyModuleDef_HEAD_INIT,
-        "P4API",
-        "P4 Python Adapter Module",
-        sizeof(struct P4API_state),
-        P4API_methods,
-        NULL,
-        P4API_traverse,
-        P4API_clear,
-        NULL
-};
+static PyObject *
+P4Record_subscript(P4Record *self, PyObject *key)
+{
+    LockPythonObject guard( (PyObject *) self );
+    PyObject * value = self->rec->GetItem(key);
+    if( !value && !PyErr_Occurred() )
+	PyErr_SetObject(PyExc_KeyError, key);
+    return value;
+}
 
-#define INITERROR return NULL
+static int
+P4Record_contains(P4Record *self, PyObject *key)
+{
+    LockPythonObject guard( (PyObject *) self );
+    return self->rec->Contains(key) ? 1 : 0;
+}
 
-PyMODINIT_FUNC
-PyInit_P4API(void)
+static PyObject *
+P4Record_iter(P4Record *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    PyObject * keys = self->rec->Keys();
+    if( !keys )
+	return NULL;
 
-#else 
+    PyObject * iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
 
-#define INITERROR return
+static PyObject *
+P4Record_keys(P4Record *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    return self->rec->Keys();
+}
 
-PyMODINIT_FUNC
-initP4API(void)
-#endif
+static PyObject *
+P4Record_values(P4Record *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    return self->rec->Values();
+}
 
+static PyObject *
+P4Record_items(P4Record *self)
 {
-    if (PyType_Ready(&P4AdapterType) < 0) 
-	INITERROR;
-    if (PyType_Ready(&P4MapType) < 0)
-        INITERROR;
-    if (PyType_Ready(&P4MergeDataType) < 0)
-        INITERROR;
-    if (PyType_Ready(&P4ActionMergeDataType) < 0)
-        INITERROR;
-    if (PyType_Ready(&P4MessageType) < 0)
-        INITERROR;
+    LockPythonObject guard( (PyObject *) self );
+    return self->rec->Items();
+}
 
-#if PY_MAJOR_VERSION >= 3
-    PyObject * module = PyModule_Create(&P4API_moduledef);
-#else
-    PyObject * module = Py_InitModule3("P4API", P4API_methods, "P4 Python Adapter Module");
-#endif
+static PyObject *
+P4Record_get(P4Record *self, PyObject *args)
+{
+    LockPythonObject guard( (PyObject *) self );
+    PyObject * key;
+    PyObject * def = Py_None;
 
-    if (module == NULL) INITERROR;
+    if( !PyArg_ParseTuple(args, "O|O", &key, &def) )
+	return NULL;
 
-    Py_INCREF(&P4AdapterType);
-    PyModule_AddObject(module, "P4Adapter", (PyObject*) &P4AdapterType);
-    
-    Py_INCREF(&P4MergeDataType);
-    PyModule_AddObject(module, "P4MergeData", (PyObject*) &P4MergeDataType);
+    PyObject * value = self->rec->GetItem(key);
+    if( !value && !PyErr_Occurred() ) {
+	Py_INCREF(def);
+	value = def;
+    }
+    return value;
+}
 
-    Py_INCREF(&P4ActionMergeDataType);
-    PyModule_AddObject(module, "P4ActionMergeData", (PyObject*) &P4ActionMergeDataType);
+static PyObject *
+P4Record_todict(P4Record *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    return self->rec->ToDict();
+}
 
-    Py_INCREF(&P4MapType);
-    PyModule_AddObject(module, "P4Map", (PyObject*) &P4MapType);
-    
-    Py_INCREF(&P4MessageType);
-    PyModule_AddObject(module, "P4Message", (PyObject*) &P4MessageType);
+static PyObject *
+P4Record_repr(P4Record *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    PyObject * dict = self->rec->ToDict();
+    if( !dict )
+	return NULL;
+
+    PyObject * repr = PyObject_Repr(dict);
+    Py_DECREF(dict);
+    return repr;
+}
 
-    struct P4API_state *st = GETSTATE(module);
+//
+// Records compare equal to dicts (and other records) with the same
+// contents, so both have to be fully materialized for the comparison.
+//
 
-    st->error = PyErr_NewException((char *)"P4API.Error", NULL, NULL);
-    if (st->error == NULL) {
-        Py_DECREF(module);
-        INITERROR;
+static PyObject *
+P4Record_richcompare(PyObject *a, PyObject *b, int op)
+{
+    if( op != Py_EQ && op != Py_NE ) {
+	Py_INCREF(Py_NotImplemented);
+	return Py_NotImplemented;
     }
 
-    // Get a reference to P4.P4Error
-    // Not declared as an exception here because of module inconsistencies
-    // Better for the user to have an exception of type P4.P4Error than
-    // P4API.P4Error
-    
-    PyObject * p4Module = PyImport_ImportModule("P4");
-    PyObject * p4Dict = PyModule_GetDict(p4Module);
-    P4Error = PyDict_GetItemString(p4Dict, "P4Exception");
-    if (P4Error) 
-    	Py_INCREF(P4Error);
-    else {
-    	PyErr_SetString(st->error, "Could not find P4.P4Exception." );
-    	Py_DECREF(module);
-        INITERROR;
+    P4API_state * st = P4API_GetState();
+    if( !st )
+	return NULL;
+
+    PyTypeObject * recordType = st->recordType;
+
+    PyObject * da = PyObject_TypeCheck(a, recordType)
+	? P4Record_todict((P4Record *) a) : (Py_INCREF(a), a);
+    if( !da )
+	return NULL;
+
+    PyObject * db = PyObject_TypeCheck(b, recordType)
+	? P4Record_todict((P4Record *) b) : (Py_INCREF(b), b);
+    if( !db ) {
+	Py_DECREF(da);
+	return NULL;
+    }
+
+    PyObject * result = NULL;
+    if( PyDict_Check(da) && PyDict_Check(db) ) {
+	result = PyObject_RichCompare(da, db, op);
     }
-    
-    P4OutputHandler = PyDict_GetItemString(p4Dict, "OutputHandler");
-    if (P4OutputHandler)
-    	Py_INCREF(P4OutputHandler);
     else {
-    	PyErr_SetString(st->error, "Could not find P4.OutputHandler." );
-    	Py_DECREF(module);
-        INITERROR;
+	Py_INCREF(Py_NotImplemented);
+	result = Py_NotImplemented;
     }
 
-    P4Progress = PyDict_GetItemString(p4Dict, "Progress");
-    if (P4Progress)
-    	Py_INCREF(P4Progress);
-    else {
-    	PyErr_SetString(st->error, "Could not find P4.Progress." );
-    	Py_DECREF(module);
-        INITERROR;
+    Py_DECREF(da);
+    Py_DECREF(db);
+    return result;
+}
+
+static PyMethodDef P4Record_methods[] = {
+    {"keys", (PyCFunction)P4Record_keys, METH_NOARGS,
+     "Returns the list of field names"},
+    {"values", (PyCFunction)P4Record_values, METH_NOARGS,
+     "Returns the list of field values"},
+    {"items", (PyCFunction)P4Record_items, METH_NOARGS,
+     "Returns the list of (name, value) tuples"},
+    {"get", (PyCFunction)P4Record_get, METH_VARARGS,
+     "Returns the value of a field, or the default if it does not exist"},
+    {"todict", (PyCFunction)P4Record_todict, METH_NOARGS,
+     "Returns the record as a plain dict"},
+    {NULL}  /* Sentinel */
+};
+
+static PyType_Slot P4Record_slots[] = {
+    {Py_tp_dealloc, (void *) P4Record_dealloc},
+    {Py_tp_repr, (void *) P4Record_repr},
+    {Py_sq_contains, (void *) P4Record_contains},
+    {Py_mp_length, (void *) P4Record_length},
+    {Py_mp_subscript, (void *) P4Record_subscript},
+    {Py_tp_hash, (void *) PyObject_HashNotImplemented},
+    {Py_tp_doc, (void *) "P4Record - read-only tagged output record"},
+    {Py_tp_richcompare, (void *) P4Record_richcompare},
+    {Py_tp_iter, (void *) P4Record_iter},
+    {Py_tp_methods, (void *) P4Record_methods},
+    {0, 0}
+};
+
+static PyType_Spec P4Record_spec = {
+    "P4API.P4Record",
+    sizeof(P4Record),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    P4Record_slots
+};
+
+// ================
+// ==== P4Pool ====
+// ================
+
+static void
+P4Pool_dealloc(P4Pool *self)
+{
+    delete self->pool;
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
+}
+
+/*
+ * P4Pool initializer. Takes a callable returning new P4 instances and
+ * the maximum number of connections to create with it.
+ */
+static int
+P4Pool_init(P4Pool *self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = { "factory", "size", NULL };
+    PyObject * factory;
+    Py_ssize_t size = 4;
+
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "O|n", (char **) kwlist,
+		&factory, &size) )
+	return -1;
+
+    if( !PyCallable_Check(factory) ) {
+	PyErr_SetString(PyExc_TypeError, "Pool factory must be callable");
+	return -1;
     }
 
-#if PY_MAJOR_VERSION >= 3
-    return module;
-#endif
+    if( size < 1 ) {
+	PyErr_SetString(PyExc_ValueError, "Pool size must be at least 1");
+	return -1;
+    }
+
+    delete self->pool;
+    self->pool = new p4py::P4ConnectionPool(factory, (size_t) size);
+    return 0;
+}
+
+static int
+P4Pool_check(P4Pool *self)
+{
+    if( self->pool )
+	return 1;
+
+    PyErr_SetString(PyExc_RuntimeError, "P4Pool has not been initialized");
+    return 0;
+}
+
+static PyObject *
+P4Pool_checkout(P4Pool *self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = { "timeout", NULL };
+    PyObject * timeout = Py_None;
+
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char **) kwlist,
+		&timeout) )
+	return NULL;
+
+    if( !P4Pool_check(self) )
+	return NULL;
+
+    double seconds = -1;
+    if( timeout != Py_None ) {
+	seconds = PyFloat_AsDouble(timeout);
+	if( seconds == -1 && PyErr_Occurred() )
+	    return NULL;
+	if( seconds < 0 )
+	    seconds = 0;
+    }
+
+    return self->pool->Checkout(seconds);
+}
+
+static PyObject *
+P4Pool_checkin(P4Pool *self, PyObject *p4)
+{
+    if( !P4Pool_check(self) || self->pool->Checkin(p4) < 0 )
+	return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+P4Pool_close(P4Pool *self)
+{
+    if( !P4Pool_check(self) )
+	return NULL;
+
+    self->pool->Close();
+    Py_RETURN_NONE;
 }
 
+static PyObject *
+P4Pool_stats(P4Pool *self)
+{
+    if( !P4Pool_check(self) )
+	return NULL;
+
+    return self->pool->Stats();
+}
+
+static PyMethodDef P4Pool_methods[] = {
+    {"checkout", (PyCFunction)P4Pool_checkout, METH_VARARGS | METH_KEYWORDS,
+     "Returns a connected P4 instance, waiting up to timeout seconds for one"},
+    {"checkin", (PyCFunction)P4Pool_checkin, METH_O,
+     "Returns a P4 instance to the pool"},
+    {"close", (PyCFunction)P4Pool_close, METH_NOARGS,
+     "Disconnects all connections and refuses further checkouts"},
+    {"stats", (PyCFunction)P4Pool_stats, METH_NOARGS,
+     "Returns a dict of pool counters"},
+    {NULL}  /* Sentinel */
+};
+
+static PyType_Slot P4Pool_slots[] = {
+    {Py_tp_dealloc, (void *) P4Pool_dealloc},
+    {Py_tp_doc, (void *) "P4Pool - shared pool of connections"},
+    {Py_tp_methods, (void *) P4Pool_methods},
+    {Py_tp_init, (void *) P4Pool_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {0, 0}
+};
+
+static PyType_Spec P4Pool_spec = {
+    "P4API.P4Pool",
+    sizeof(P4Pool),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    P4Pool_slots
+};
+
+// =================
+// ==== P4Batch ====
+// =================
+
+static void
+P4Batch_dealloc(P4Batch *self)
+{
+    delete self->batch;
+    PyTypeObject * tp = Py_TYPE(self);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
+}
+
+/*
+ * P4Batch initializer. Takes a list of connected P4 instances and a list
+ * of argument tuples for run(), and starts running the commands.
+ */
+static int
+P4Batch_init(P4Batch *self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = { "workers", "commands", NULL };
+    PyObject * workers;
+    PyObject * commands;
+
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "OO", (char **) kwlist,
+		&workers, &commands) )
+	return -1;
+
+    if( !PySequence_Check(workers) || !PySequence_Check(commands) ) {
+	PyErr_SetString(PyExc_TypeError,
+		"P4Batch expects sequences of connections and commands");
+	return -1;
+    }
+
+    P4API_state * st = P4API_GetState();
+    if( !st )
+	return -1;
+
+    PyTypeObject * adapterType = st->adapterType;
+    Py_ssize_t n = PySequence_Size(workers);
+    for( Py_ssize_t i = 0; i < n; i++ ) {
+	PyObject * p4 = PySequence_GetItem(workers, i);
+	if( !p4 )
+	    return -1;
+
+	bool ok = PyObject_TypeCheck(p4, adapterType);
+	Py_DECREF(p4);
+	if( !ok ) {
+	    PyErr_SetString(PyExc_TypeError, "P4Batch workers must be P4 instances");
+	    return -1;
+	}
+    }
+
+    if( self->batch )
+	return 0;
+
+    self->batch = new p4py::P4CommandBatch(workers, commands);
+    self->batch->Start();
+    return 0;
+}
+
+static PyObject *
+P4Batch_iter(PyObject *self)
+{
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject *
+P4Batch_iternext(P4Batch *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    if( !self->batch )
+	return NULL;
+
+    return self->batch->Next();
+}
+
+static PyObject *
+P4Batch_close(P4Batch *self)
+{
+    LockPythonObject guard( (PyObject *) self );
+    if( self->batch )
+	self->batch->Close();
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef P4Batch_methods[] = {
+    {"close", (PyCFunction)P4Batch_close, METH_NOARGS,
+     "Skips the commands not started yet and waits for the running ones"},
+    {NULL}  /* Sentinel */
+};
+
+static PyType_Slot P4Batch_slots[] = {
+    {Py_tp_dealloc, (void *) P4Batch_dealloc},
+    {Py_tp_doc, (void *) "P4Batch - commands running concurrently"},
+    {Py_tp_iter, (void *) P4Batch_iter},
+    {Py_tp_iternext, (void *) P4Batch_iternext},
+    {Py_tp_methods, (void *) P4Batch_methods},
+    {Py_tp_init, (void *) P4Batch_init},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {0, 0}
+};
+
+static PyType_Spec P4Batch_spec = {
+    "P4API.P4Batch",
+    sizeof(P4Batch),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    P4Batch_slots
+};
+
+// ================
+// ==== P4Spec ====
+// ================
+
+//
+// The field table of a spec definition is shared by all the specs created
+// from it, and never changes. It is a tuple of the map from lower case
+// names to field names, the set of field names, and the attribute names
+// used so far (_client, _Client, ...) with their field names, or None if
+// they do not name a field.
+//
+
+enum { SPEC_FIELDMAP, SPEC_NAMES, SPEC_ATTRS, SPEC_TABLE_SIZE };
+
+// Attribute names come from code and are few, but getattr() takes anything
+static const Py_ssize_t MAX_SPEC_ATTRS = 1024;
+
+PyObject * P4Spec_NewFields( PyObject * fieldmap )
+{
+    PyObject * map = PyDict_New();
+    if( !map )
+	return NULL;
+
+    if( PyDict_Update(map, fieldmap) < 0 ) {
+	Py_DECREF(map);
+	return NULL;
+    }
+
+    PyObject * values = PyDict_Values(map);
+    PyObject * names = values ? PyFrozenSet_New(values) : NULL;
+    PyObject * attrs = names ? PyDict_New() : NULL;
+    PyObject * table = attrs ? PyTuple_Pack(SPEC_TABLE_SIZE, map, names, attrs) : NULL;
+
+    Py_XDECREF(attrs);
+    Py_XDECREF(names);
+    Py_XDECREF(values);
+    Py_DECREF(map);
+    return table;
+}
+
+PyObject * P4Spec_FieldMap( PyObject * fields )
+{
+    return PyTuple_GET_ITEM(fields, SPEC_FIELDMAP);
+}
+
+//
+// P4.Spec is defined after P4.py has imported P4API, so it cannot be
+// fetched in P4API_exec. It is looked up the first time a spec is
+// created; until P4.py has defined it, plain P4API.P4Spec is used.
+//
+
+static std::mutex specClassLock;
+
+static PyTypeObject * P4Spec_class( P4API_state * st )
+{
+    if( !st )
+	return NULL;
+
+    {
+	std::lock_guard<std::mutex> lock(specClassLock);
+	if( st->specClass )
+	    return (PyTypeObject *) st->specClass;
+    }
+
+    PyObject * name = PyUnicode_FromString("P4");
+    if( !name )
+	return NULL;
+
+    PyObject * p4Module = PyImport_GetModule(name);
+    Py_DECREF(name);
+    if( !p4Module ) {
+	if( PyErr_Occurred() )
+	    return NULL;
+	return st->specType;
+    }
+
+    PyObject * cls = PyObject_GetAttrString(p4Module, "Spec");
+    Py_DECREF(p4Module);
+    if( !cls ) {
+	PyErr_Clear();
+	return st->specType;
+    }
+
+    // SpecMgr creates P4.Spec objects as P4Spec
+    if( !PyType_Check(cls) || !PyType_IsSubtype((PyTypeObject *) cls, st->specType) ) {
+	Py_DECREF(cls);
+	PyErr_SetString(st->error, "P4.Spec must derive from P4API.P4Spec.");
+	return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(specClassLock);
+    if( st->specClass )
+	Py_DECREF(cls);
+    else
+	st->specClass = cls;
+    return (PyTypeObject *) st->specClass;
+}
+
+PyObject * P4Spec_New( PyObject * fields )
+{
+    PyTypeObject * type = P4Spec_class(P4API_GetState());
+    if( !type )
+	return NULL;
+
+    PyObject * args = PyTuple_New(0);
+    if( !args )
+	return NULL;
+
+    PyObject * self = PyDict_Type.tp_new(type, args, NULL);
+    Py_DECREF(args);
+
+    if( self && fields ) {
+	Py_INCREF(fields);
+	((P4Spec *) self)->fields = fields;
+    }
+    return self;
+}
+
+// Looks up key in dict, returning a new reference in *item: 1 if found,
+// 0 if not, -1 on error
+
+static int
+P4Spec_getItemRef(PyObject *dict, PyObject *key, PyObject **item)
+{
+#if PY_VERSION_HEX >= 0x030D0000
+    return PyDict_GetItemRef(dict, key, item);
+#else
+    *item = PyDict_GetItemWithError(dict, key);
+    if( *item ) {
+	Py_INCREF(*item);
+	return 1;
+    }
+    return PyErr_Occurred() ? -1 : 0;
+#endif
+}
+
+// "_Client" -> "client"
+
+static PyObject *
+P4Spec_attrKey(PyObject *name)
+{
+    PyObject * lower = PyObject_CallMethod(name, "lower", NULL);
+    if( !lower )
+	return NULL;
+
+    PyObject * key = PyUnicode_Substring(lower, 1, PyUnicode_GET_LENGTH(lower));
+    Py_DECREF(lower);
+    return key;
+}
+
+// Names starting with a single underscore are field shortcuts
+
+static int
+P4Spec_isShortcut(PyObject *name)
+{
+    return PyUnicode_Check(name) && PyUnicode_GET_LENGTH(name) > 1
+	&& PyUnicode_READ_CHAR(name, 0) == '_'
+	&& PyUnicode_READ_CHAR(name, 1) != '_';
+}
+
+//
+// Returns the field name for a shortcut attribute as a new reference, or
+// None if there is no such field. Answers come from the cache of the
+// field table after the first time.
+//
+
+static PyObject *
+P4Spec_attrField(P4Spec *self, PyObject *name)
+{
+    PyObject * attrs = PyTuple_GET_ITEM(self->fields, SPEC_ATTRS);
+    PyObject * field;
+
+    int found = P4Spec_getItemRef(attrs, name, &field);
+    if( found )
+	return found < 0 ? NULL : field;
+
+    PyObject * key = P4Spec_attrKey(name);
+    if( !key )
+	return NULL;
+
+    found = P4Spec_getItemRef(PyTuple_GET_ITEM(self->fields, SPEC_FIELDMAP), key, &field);
+    Py_DECREF(key);
+    if( found < 0 )
+	return NULL;
+
+    if( !found ) {
+	Py_INCREF(Py_None);
+	field = Py_None;
+    }
+
+    if( PyDict_GET_SIZE(attrs) < MAX_SPEC_ATTRS && PyDict_SetItem(attrs, name, field) < 0 ) {
+	Py_DECREF(field);
+	return NULL;
+    }
+    return field;
+}
+
+static int
+P4Spec_traverse(P4Spec *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->fields);
+    Py_VISIT(Py_TYPE(self));
+    return PyDict_Type.tp_traverse((PyObject *) self, visit, arg);
+}
+
+static int
+P4Spec_clear(P4Spec *self)
+{
+    Py_CLEAR(self->fields);
+    return PyDict_Type.tp_clear((PyObject *) self);
+}
+
+static void
+P4Spec_dealloc(P4Spec *self)
+{
+    PyTypeObject * tp = Py_TYPE(self);
+    PyObject_GC_UnTrack(self);
+    Py_CLEAR(self->fields);
+    PyDict_Type.tp_dealloc((PyObject *) self);
+    Py_DECREF(tp);
+}
+
+/*
+ * P4Spec initializer. Takes the map of lower case names to field names;
+ * without one any key is accepted.
+ */
+static int
+P4Spec_init(P4Spec *self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = { "fieldmap", NULL };
+    PyObject * fieldmap = Py_None;
+
+    if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char **) kwlist,
+		&fieldmap) )
+	return -1;
+
+    PyObject * fields = NULL;
+    if( fieldmap != Py_None && !(fields = P4Spec_NewFields(fieldmap)) )
+	return -1;
+
+    Py_XSETREF(self->fields, fields);
+    return 0;
+}
+
+static int
+P4Spec_ass_subscript(P4Spec *self, PyObject *key, PyObject *value)
+{
+    if( !value )
+	return PyDict_DelItem((PyObject *) self, key);
+
+    if( !PyUnicode_Check(value) && !PyList_Check(value) ) {
+	PyErr_Format(P4API_ErrorType(),
+		"Illegal value of type %S, must be string or list",
+		(PyObject *) Py_TYPE(value));
+	return -1;
+    }
+
+    if( !self->fields )
+	return PyDict_SetItem((PyObject *) self, key, value);
+
+    int known = PyDict_Contains((PyObject *) self, key);
+    if( !known )
+	known = PySet_Contains(PyTuple_GET_ITEM(self->fields, SPEC_NAMES), key);
+    if( known < 0 )
+	return -1;
+    if( known )
+	return PyDict_SetItem((PyObject *) self, key, value);
+
+    // Field names are case insensitive
+    PyObject * str = PyObject_Str(key);
+    PyObject * lower = str ? PyObject_CallMethod(str, "lower", NULL) : NULL;
+    PyObject * field = NULL;
+    int found = lower
+	? P4Spec_getItemRef(PyTuple_GET_ITEM(self->fields, SPEC_FIELDMAP), lower, &field)
+	: -1;
+
+    int result = -1;
+    if( found > 0 )
+	result = PyDict_SetItem((PyObject *) self, field, value);
+    else if( !found )
+	PyErr_Format(P4API_ErrorType(), "Illegal field '%S'", str);
+
+    Py_XDECREF(field);
+    Py_XDECREF(lower);
+    Py_XDECREF(str);
+    return result;
+}
+
+//
+// spec._field returns spec['Field']. Unknown shortcuts return None rather
+// than raising AttributeError.
+//
+
+static PyObject *
+P4Spec_getattro(P4Spec *self, PyObject *name)
+{
+    int shortcut = P4Spec_isShortcut(name);
+
+    if( shortcut && self->fields ) {
+	PyObject * field = P4Spec_attrField(self, name);
+	if( !field )
+	    return NULL;
+
+	if( field != Py_None ) {
+	    PyObject * value = PyObject_GetItem((PyObject *) self, field);
+	    Py_DECREF(field);
+	    return value;
+	}
+	Py_DECREF(field);
+    }
+
+    PyObject * value = PyObject_GenericGetAttr((PyObject *) self, name);
+    if( value || !shortcut || !PyErr_ExceptionMatches(PyExc_AttributeError) )
+	return value;
+
+    PyErr_Clear();
+
+    // Fields added to the spec outside of the spec definition
+    PyObject * key = P4Spec_attrKey(name);
+    if( !key )
+	return NULL;
+
+    int found = P4Spec_getItemRef((PyObject *) self, key, &value);
+    Py_DECREF(key);
+    if( found < 0 )
+	return NULL;
+
+    if( !found )
+	Py_RETURN_NONE;
+    return value;
+}
+
+static int
+P4Spec_setattro(P4Spec *self, PyObject *name, PyObject *value)
+{
+    if( !value || !PyUnicode_Check(name)
+	    || !PyUnicode_CompareWithASCIIString(name, "comment") )
+	return PyObject_GenericSetAttr((PyObject *) self, name, value);
+
+    if( PyUnicode_GET_LENGTH(name) == 0 || PyUnicode_READ_CHAR(name, 0) != '_' ) {
+	PyErr_SetObject(PyExc_AttributeError, name);
+	return -1;
+    }
+
+    if( self->fields && P4Spec_isShortcut(name) ) {
+	PyObject * field = P4Spec_attrField(self, name);
+	if( !field )
+	    return -1;
+
+	int result = field != Py_None
+	    ? P4Spec_ass_subscript(self, field, value)
+	    : 1;
+	Py_DECREF(field);
+	if( result <= 0 )
+	    return result;
+    }
+
+    // Not a field, which the check of the key reports
+    PyObject * key = P4Spec_attrKey(name);
+    if( !key )
+	return -1;
+
+    int result = P4Spec_ass_subscript(self, key, value);
+    Py_DECREF(key);
+    return result;
+}
+
+static PyObject *
+P4Spec_permitted_fields(P4Spec *self)
+{
+    if( !self->fields )
+	Py_RETURN_NONE;
+
+    return PyDictProxy_New(PyTuple_GET_ITEM(self->fields, SPEC_FIELDMAP));
+}
+
+//
+// Specs are pickled and copied with their field table and comment. The
+// items are restored with __setstate__() rather than one by one, so that
+// fields outside the spec definition survive.
+//
+
+static PyObject *
+P4Spec_reduce(P4Spec *self)
+{
+    PyObject * map = self->fields ? P4Spec_FieldMap(self->fields) : Py_None;
+
+    PyObject * attrs = PyObject_GenericGetDict((PyObject *) self, NULL);
+    if( !attrs ) {
+	if( !PyErr_ExceptionMatches(PyExc_AttributeError) )
+	    return NULL;
+	PyErr_Clear();
+	Py_INCREF(Py_None);
+	attrs = Py_None;
+    }
+
+    PyObject * items = PyDict_Copy((PyObject *) self);
+    if( !items ) {
+	Py_DECREF(attrs);
+	return NULL;
+    }
+
+    return Py_BuildValue("O(O)(NN)", (PyObject *) Py_TYPE(self), map, items, attrs);
+}
+
+static PyObject *
+P4Spec_setstate(P4Spec *self, PyObject *state)
+{
+    PyObject * items;
+    PyObject * attrs;
+
+    if( !PyArg_ParseTuple(state, "O!O", &PyDict_Type, &items, &attrs) )
+	return NULL;
+
+    if( PyDict_Update((PyObject *) self, items) < 0 )
+	return NULL;
+
+    if( attrs != Py_None ) {
+	PyObject * dict = PyObject_GenericGetDict((PyObject *) self, NULL);
+	int rc = dict ? PyDict_Update(dict, attrs) : -1;
+	Py_XDECREF(dict);
+	if( rc < 0 )
+	    return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef P4Spec_methods[] = {
+    {"permitted_fields", (PyCFunction)P4Spec_permitted_fields, METH_NOARGS,
+     "Returns the map of lower case names to field names"},
+    {"__reduce__", (PyCFunction)P4Spec_reduce, METH_NOARGS,
+     "Helper for pickle"},
+    {"__setstate__", (PyCFunction)P4Spec_setstate, METH_O,
+     "Helper for pickle"},
+    {NULL}  /* Sentinel */
+};
+
+static PyType_Slot P4Spec_slots[] = {
+    {Py_tp_base, (void *) &PyDict_Type},
+    {Py_tp_dealloc, (void *) P4Spec_dealloc},
+    {Py_tp_traverse, (void *) P4Spec_traverse},
+    {Py_tp_clear, (void *) P4Spec_clear},
+    {Py_tp_init, (void *) P4Spec_init},
+    {Py_tp_getattro, (void *) P4Spec_getattro},
+    {Py_tp_setattro, (void *) P4Spec_setattro},
+    {Py_mp_ass_subscript, (void *) P4Spec_ass_subscript},
+    {Py_tp_doc, (void *) "P4Spec - dict checking its keys against the fields of a spec definition"},
+    {Py_tp_methods, (void *) P4Spec_methods},
+    {0, 0}
+};
+
+static PyType_Spec P4Spec_spec = {
+    "P4API.P4Spec",
+    sizeof(P4Spec),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC,
+    P4Spec_slots
+};
+
+// ===============
+// ==== P4API ====
+// ===============
+
+#define GETSTATE(m) ((struct P4API_state*)PyModule_GetState(m))
+
+//
+// The C++ code deep inside the callbacks has no module at hand, so the
+// state of the module imported into each interpreter is registered in the
+// interpreter's dict. The last lookup is cached per thread; the generation
+// changes whenever a module is freed, so a stale entry is never used.
+//
+
+static const char * P4API_STATE_KEY = "P4API.state";
+static std::atomic<unsigned> stateGeneration( 1 );
+
+P4API_state * P4API_GetState()
+{
+    static thread_local PyInterpreterState * cachedInterp = NULL;
+    static thread_local P4API_state * cachedState = NULL;
+    static thread_local unsigned cachedGeneration = 0;
+
+    PyInterpreterState * interp = PyInterpreterState_Get();
+    unsigned generation = stateGeneration;
+
+    if( interp == cachedInterp && generation == cachedGeneration )
+	return cachedState;
+
+    PyObject * dict = PyInterpreterState_GetDict(interp);
+    PyObject * capsule = dict ? PyDict_GetItemString(dict, P4API_STATE_KEY) : NULL;
+    P4API_state * st = capsule
+	? (P4API_state *) PyCapsule_GetPointer(capsule, P4API_STATE_KEY) : NULL;
+
+    if( st ) {
+	cachedInterp = interp;
+	cachedState = st;
+	cachedGeneration = generation;
+    }
+    else
+	PyErr_SetString(PyExc_RuntimeError,
+		"P4API has not been imported into this interpreter");
+
+    return st;
+}
+
+PyObject * P4API_ErrorType()
+{
+    P4API_state * st = P4API_GetState();
+    return st && st->p4Error ? st->p4Error : PyExc_RuntimeError;
+}
+
+static int P4API_register(P4API_state * st)
+{
+    PyObject * dict = PyInterpreterState_GetDict(PyInterpreterState_Get());
+    if( !dict ) {
+	PyErr_SetString(PyExc_RuntimeError, "No interpreter state dict for P4API");
+	return -1;
+    }
+
+    PyObject * capsule = PyCapsule_New(st, P4API_STATE_KEY, NULL);
+    if( !capsule )
+	return -1;
+
+    int result = PyDict_SetItemString(dict, P4API_STATE_KEY, capsule);
+    Py_DECREF(capsule);
+
+    stateGeneration++;
+    return result;
+}
+
+static void P4API_unregister(P4API_state * st)
+{
+    PyObject * dict = PyInterpreterState_GetDict(PyInterpreterState_Get());
+    PyObject * capsule = dict ? PyDict_GetItemString(dict, P4API_STATE_KEY) : NULL;
+
+    if( capsule && PyCapsule_GetPointer(capsule, P4API_STATE_KEY) == st )
+	PyDict_DelItemString(dict, P4API_STATE_KEY);
+
+    PyErr_Clear();
+    stateGeneration++;
+}
+
+static struct PyMethodDef P4API_methods[] = {
+    {"identify", (PyCFunction)P4API_identify, METH_NOARGS, "Identify module version"},
+    {"dvcs_init", (PyCFunction)P4API_dvcs_init, METH_VARARGS | METH_KEYWORDS, "Initialize local server"},
+    {"dvcs_clone", (PyCFunction)P4API_dvcs_clone, METH_VARARGS | METH_KEYWORDS, "Clone local server"},
+    {NULL} /* Sentinel */
+};
+
+// ===================
+// ==== initP4API ====
+// ===================
+
+static int P4API_traverse(PyObject *m, visitproc visit, void *arg) {
+    P4API_state *st = GETSTATE(m);
+    Py_VISIT(st->error);
+    Py_VISIT(st->p4Error);
+    Py_VISIT(st->outputHandler);
+    Py_VISIT(st->progress);
+    Py_VISIT(st->specClass);
+    Py_VISIT(st->adapterType);
+    Py_VISIT(st->mergeDataType);
+    Py_VISIT(st->actionMergeDataType);
+    Py_VISIT(st->mapType);
+    Py_VISIT(st->messageType);
+    Py_VISIT(st->resultIteratorType);
+    Py_VISIT(st->recordType);
+    Py_VISIT(st->poolType);
+    Py_VISIT(st->batchType);
+    Py_VISIT(st->specType);
+    return 0;
+}
+
+static int P4API_clear(PyObject *m) {
+    P4API_state *st = GETSTATE(m);
+    Py_CLEAR(st->error);
+    Py_CLEAR(st->p4Error);
+    Py_CLEAR(st->outputHandler);
+    Py_CLEAR(st->progress);
+    Py_CLEAR(st->specClass);
+    Py_CLEAR(st->adapterType);
+    Py_CLEAR(st->mergeDataType);
+    Py_CLEAR(st->actionMergeDataType);
+    Py_CLEAR(st->mapType);
+    Py_CLEAR(st->messageType);
+    Py_CLEAR(st->resultIteratorType);
+    Py_CLEAR(st->recordType);
+    Py_CLEAR(st->poolType);
+    Py_CLEAR(st->batchType);
+    Py_CLEAR(st->specType);
+    return 0;
+}
+
+static void P4API_free(void *m) {
+    P4API_unregister(GETSTATE((PyObject *) m));
+    P4API_clear((PyObject *) m);
+}
+
+//
+// Creates a type from its spec, adds it to the module and keeps a
+// reference in the module state.
+//
+
+static int P4API_addType(PyObject *module, PyType_Spec *spec, PyTypeObject **type)
+{
+    *type = (PyTypeObject *) PyType_FromModuleAndSpec(module, spec, NULL);
+    if( !*type )
+	return -1;
+
+    return PyModule_AddType(module, *type);
+}
+
+//
+// Fetches a class defined in P4.py; they are not declared here because
+// users should see P4.P4Exception rather than P4API.P4Exception.
+//
+
+static int P4API_getClass(P4API_state *st, PyObject *p4Module, const char *name, PyObject **cls)
+{
+    *cls = PyObject_GetAttrString(p4Module, name);
+    if( *cls )
+	return 0;
+
+    PyErr_Clear();
+    PyErr_Format(st->error, "Could not find P4.%s.", name);
+    return -1;
+}
+
+static int P4API_exec(PyObject *module)
+{
+    P4API_state *st = GETSTATE(module);
+
+    st->error = PyErr_NewException((char *)"P4API.Error", NULL, NULL);
+    if( !st->error )
+	return -1;
+
+    if( P4API_register(st) < 0 )
+	return -1;
+
+    // The types have to exist before P4.py is imported, since it
+    // derives its classes from them.
+
+    if( P4API_addType(module, &P4Adapter_spec, &st->adapterType) < 0 ||
+	P4API_addType(module, &P4MergeData_spec, &st->mergeDataType) < 0 ||
+	P4API_addType(module, &P4ActionMergeData_spec, &st->actionMergeDataType) < 0 ||
+	P4API_addType(module, &P4Map_spec, &st->mapType) < 0 ||
+	P4API_addType(module, &P4Message_spec, &st->messageType) < 0 ||
+	P4API_addType(module, &P4ResultIterator_spec, &st->resultIteratorType) < 0 ||
+	P4API_addType(module, &P4Record_spec, &st->recordType) < 0 ||
+	P4API_addType(module, &P4Pool_spec, &st->poolType) < 0 ||
+	P4API_addType(module, &P4Batch_spec, &st->batchType) < 0 ||
+	P4API_addType(module, &P4Spec_spec, &st->specType) < 0 )
+	return -1;
+
+    PyObject * p4Module = PyImport_ImportModule("P4");
+    if( !p4Module )
+	return -1;
+
+    int result = 0;
+    if( P4API_getClass(st, p4Module, "P4Exception", &st->p4Error) < 0 ||
+	P4API_getClass(st, p4Module, "OutputHandler", &st->outputHandler) < 0 ||
+	P4API_getClass(st, p4Module, "Progress", &st->progress) < 0 )
+	result = -1;
+
+    Py_DECREF(p4Module);
+    return result;
+}
+
+static PyModuleDef_Slot P4API_slots[] = {
+    {Py_mod_exec, (void *) P4API_exec},
+#if PY_VERSION_HEX >= 0x030C0000
+    // Nothing is shared between interpreters, see P4API_GetState()
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_GIL_DISABLED
+    // Every object locks its own state, see LockPythonObject
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef P4API_moduledef = {
+        PyModuleDef_HEAD_INIT,
+        "P4API",
+        "P4 Python Adapter Module",
+        sizeof(struct P4API_state),
+        P4API_methods,
+        P4API_slots,
+        P4API_traverse,
+        P4API_clear,
+        P4API_free
+};
+
+PyMODINIT_FUNC
+PyInit_P4API(void)
+{
+    return PyModuleDef_Init(&P4API_moduledef);
+}
@@ -0,0 +1,162 @@
+/*
+ * P4CommandBatch. Runs independent commands concurrently over several
+ * connections.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4CommandBatch.cpp#1 $
+ *
+ */
+
+#include <Python.h>
+#include "P4ResultQueue.h"
+#include "P4CommandBatch.h"
+#include "PythonThreadGuard.h"
+
+using namespace std;
+
+namespace p4py {
+
+P4CommandBatch::P4CommandBatch( PyObject * w, PyObject * c )
+    : workers( w ),
+      commands( c ),
+      count( PySequence_Size( c ) ),
+      next( 0 ),
+      running( 0 ),
+      cancelled( false ),
+      interp( PyInterpreterState_Get() )
+{
+    Py_INCREF( workers );
+    Py_INCREF( commands );
+
+    queue = new P4ResultQueue( count > 0 ? (size_t) count : 1 );
+}
+
+P4CommandBatch::~P4CommandBatch()
+{
+    Close();
+
+    delete queue;
+    Py_DECREF( workers );
+    Py_DECREF( commands );
+}
+
+void P4CommandBatch::Start()
+{
+    Py_ssize_t n = PySequence_Size( workers );
+    if( n > count )
+	n = count;
+
+    if( n <= 0 ) {
+	queue->Done();
+	return;
+    }
+
+    running = (int) n;
+
+    for( Py_ssize_t i = 0; i < n; i++ ) {
+	PyObject * p4 = PySequence_GetItem( workers, i );
+	threads.push_back( new thread( &P4CommandBatch::Worker, this, p4 ) );
+    }
+}
+
+PyObject * P4CommandBatch::Next()
+{
+    return queue->Pop();
+}
+
+void P4CommandBatch::Close()
+{
+    if( threads.empty() )
+	return;
+
+    cancelled = true;
+    queue->Close();
+
+    {
+	ReleasePythonLock guard;
+	for( size_t i = 0; i < threads.size(); i++ ) {
+	    threads[i]->join();
+	    delete threads[i];
+	}
+    }
+
+    threads.clear();
+}
+
+//
+// Body of each thread. The thread state is kept for the whole batch, the
+// GIL is only released inside run() while the server does the work.
+//
+
+void P4CommandBatch::Worker( PyObject * p4 )
+{
+    AttachPythonThread guard( interp );
+
+    PyObject * run = PyObject_GetAttrString( p4, "run" );
+
+    while( run && !cancelled ) {
+	Py_ssize_t i = next++;
+	if( i >= count )
+	    break;
+
+	PyObject * args = PySequence_GetItem( commands, i );
+	PyObject * result = args ? PyObject_CallObject( run, args ) : NULL;
+	Py_XDECREF( args );
+
+	if( !result ) {
+	    PyObject *type, *value, *tb;
+	    PyErr_Fetch( &type, &value, &tb );
+	    PyErr_NormalizeException( &type, &value, &tb );
+	    if( tb && value )
+		PyException_SetTraceback( value, tb );
+	    result = value;
+	    Py_XDECREF( type );
+	    Py_XDECREF( tb );
+
+	    if( !result ) {
+		Py_INCREF( Py_None );
+		result = Py_None;
+	    }
+	}
+
+	PyObject * item = Py_BuildValue( "(nN)", i, result );
+	if( !item || queue->Push( item ) < 0 ) {
+	    PyErr_Clear();
+	    break;
+	}
+    }
+
+    if( !run )
+	PyErr_Clear();
+
+    Py_XDECREF( run );
+    Py_DECREF( p4 );
+
+    if( --running == 0 )
+	queue->Done();
+}
+
+}
@@ -0,0 +1,92 @@
+/*
+ * P4CommandBatch. Runs independent commands concurrently over several
+ * connections.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4CommandBatch.h#1 $
+ *
+ */
+
+#ifndef P4COMMANDBATCH_H
+#define P4COMMANDBATCH_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+
+namespace p4py
+{
+class P4ResultQueue;
+
+//
+// Runs a list of commands over a set of connected P4 objects, one native
+// thread per connection. Each thread takes the next command that nobody
+// has started yet, runs it with the run() method of its P4 object and
+// queues an (index, result) tuple. ClientApi::Run() releases the GIL, so
+// the commands really do run concurrently; only the conversion of the
+// results is serialized.
+//
+// A command that raises has the exception instance as its result, the
+// rest of the batch carries on.
+//
+
+class P4CommandBatch
+{
+public:
+
+    // Both workers and commands must be sequences; each command is a
+    // tuple of arguments for run().
+    P4CommandBatch( PyObject * workers, PyObject * commands );
+    ~P4CommandBatch();
+
+    void	Start();
+
+    // Returns the next (index, result) tuple in order of completion, or
+    // NULL once every command has completed.
+    PyObject *	Next();
+
+    // Abandons the commands that have not been started yet and waits for
+    // the running ones.
+    void	Close();
+
+private:
+    void	Worker( PyObject * p4 );
+
+    PyObject *			workers;
+    PyObject *			commands;
+    Py_ssize_t			count;
+
+    std::atomic<Py_ssize_t>	next;
+    std::atomic<int>		running;
+    std::atomic<bool>		cancelled;
+
+    PyInterpreterState *	interp;
+    P4ResultQueue *		queue;
+    std::vector<std::thread *>	threads;
+};
+}
+
+#endif
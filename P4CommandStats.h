@@ -0,0 +1,94 @@
+/*
+ * P4CommandStats. Client side timings and counters of the last command.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4CommandStats.h#1 $
+ *
+ */
+
+#ifndef P4COMMANDSTATS_H
+#define P4COMMANDSTATS_H
+
+#include <chrono>
+
+namespace p4py
+{
+
+//
+// Collected for every command, so updating it must stay cheap: a couple
+// of monotonic clock reads per callback and no allocation. Times are in
+// seconds. Every Python callback runs inside a section timed into
+// gilTime, so callbackTime is a part of gilTime, and gilTime of runTime.
+//
+
+struct P4CommandStats
+{
+    P4CommandStats() { Reset(); }
+
+    void Reset()
+    {
+	runTime = gilTime = callbackTime = 0.0;
+	statRecords = textRecords = binaryRecords = infoRecords = 0;
+	messages = results = peakResults = 0;
+	bytes = 0;
+    }
+
+    double		runTime;	// in ClientApi::Run()
+    double		gilTime;	// in the callbacks with the GIL held
+    double		callbackTime;	// in Python code called back
+    unsigned long	statRecords;
+    unsigned long	textRecords;
+    unsigned long	binaryRecords;
+    unsigned long	infoRecords;
+    unsigned long	messages;
+    unsigned long	results;	// objects added to the result
+    unsigned long	peakResults;	// most results held at one time, a count
+    unsigned long long	bytes;		// output, tagged fields and messages
+};
+
+//
+// Adds the time until it goes out of scope to a P4CommandStats field
+//
+
+class P4StatsTimer
+{
+public:
+    P4StatsTimer( double & t )
+	: total( t ), start( std::chrono::steady_clock::now() ) {}
+
+    ~P4StatsTimer()
+    {
+	total += std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start ).count();
+    }
+
+private:
+    double &				total;
+    std::chrono::steady_clock::time_point	start;
+};
+}
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * P4ConnectionPool. A fixed number of connections to the same server,
+ * shared between threads.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4ConnectionPool.cpp#1 $
+ *
+ */
+
+#include <Python.h>
+#include "undefdups.h"
+#include "python2to3.h"
+#include <clientapi.h>
+#include <spec.h>
+#include <ident.h>
+
+#include "P4PythonDebug.h"
+#include "SpecMgr.h"
+#include "P4Result.h"
+#include "PythonClientUser.h"
+#include "PythonClientAPI.h"
+#include "PythonTypes.h"
+#include "PythonThreadGuard.h"
+#include "P4ConnectionPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+namespace p4py {
+
+P4ConnectionPool::P4ConnectionPool( PyObject * f, size_t size )
+    : factory( f ),
+      capacity( size ? size : 1 ),
+      creating( 0 ),
+      closed( false ),
+      checkouts( 0 ),
+      waits( 0 ),
+      reconnects( 0 )
+{
+    Py_INCREF( factory );
+}
+
+P4ConnectionPool::~P4ConnectionPool()
+{
+    Close();
+
+    for( size_t i = 0; i < connections.size(); i++ )
+	Py_DECREF( connections[i] );
+
+    Py_DECREF( factory );
+}
+
+PyObject * P4ConnectionPool::Checkout( double timeout )
+{
+    PyObject *	p4 = NULL;
+    bool	create = false;
+
+    {
+	ReleasePythonLock guard;
+	unique_lock<mutex> lock( poolLock );
+
+	auto ready = [this] {
+	    return closed || !idle.empty()
+		|| connections.size() + creating < capacity;
+	};
+
+	if( !ready() ) {
+	    waits++;
+	    if( timeout < 0 )
+		available.wait( lock, ready );
+	    else
+		available.wait_for( lock, chrono::duration<double>( timeout ), ready );
+	}
+
+	if( !closed ) {
+	    if( !idle.empty() ) {
+		p4 = idle.front();
+		idle.pop_front();
+	    }
+	    else if( connections.size() + creating < capacity ) {
+		creating++;
+		create = true;
+	    }
+	}
+    }
+
+    // Only connections actually handed out count as checkouts
+
+    if( create ) {
+	p4 = Create();
+
+	lock_guard<mutex> lock( poolLock );
+	creating--;
+	if( p4 ) {
+	    connections.push_back( p4 );
+	    checkouts++;
+	}
+	else
+	    available.notify_one();
+    }
+    else if( p4 ) {
+	bool failed = Revive( p4 ) < 0;
+
+	lock_guard<mutex> lock( poolLock );
+	if( failed ) {
+	    idle.push_back( p4 );
+	    available.notify_one();
+	    return NULL;
+	}
+	checkouts++;
+    }
+    else {
+	PyErr_SetString( P4API_ErrorType(), IsClosed() ? "Connection pool is closed"
+		: "Timed out waiting for a connection from the pool" );
+	return NULL;
+    }
+
+    if( p4 )
+	Py_INCREF( p4 );
+    return p4;
+}
+
+bool P4ConnectionPool::IsClosed()
+{
+    lock_guard<mutex> lock( poolLock );
+    return closed;
+}
+
+int P4ConnectionPool::Checkin( PyObject * p4 )
+{
+    {
+	lock_guard<mutex> lock( poolLock );
+
+	if( !CheckedOut( p4 ) ) {
+	    PyErr_SetString( PyExc_ValueError,
+		    "Connection is not checked out from this pool" );
+	    return -1;
+	}
+    }
+
+    // A streamed command left open by the borrower would otherwise keep
+    // the connection busy for the next one.
+    Abandon( p4 );
+
+    bool drop;
+    {
+	lock_guard<mutex> lock( poolLock );
+
+	if( !CheckedOut( p4 ) ) {
+	    PyErr_SetString( PyExc_ValueError,
+		    "Connection is not checked out from this pool" );
+	    return -1;
+	}
+
+	drop = closed;
+	if( !drop ) {
+	    idle.push_back( p4 );
+	    available.notify_one();
+	}
+    }
+
+    if( drop )
+	Disconnect( p4 );
+
+    return 0;
+}
+
+void P4ConnectionPool::Close()
+{
+    deque<PyObject *> pending;
+    {
+	lock_guard<mutex> lock( poolLock );
+	closed = true;
+	pending.swap( idle );
+	available.notify_all();
+    }
+
+    for( size_t i = 0; i < pending.size(); i++ )
+	Disconnect( pending[i] );
+}
+
+PyObject * P4ConnectionPool::Stats()
+{
+    lock_guard<mutex> lock( poolLock );
+
+    return Py_BuildValue( "{s:n,s:n,s:n,s:k,s:k,s:k}",
+	    "size", (Py_ssize_t) capacity,
+	    "connections", (Py_ssize_t) connections.size(),
+	    "idle", (Py_ssize_t) idle.size(),
+	    "checkouts", checkouts,
+	    "waits", waits,
+	    "reconnects", reconnects );
+}
+
+//
+// Creates a new connection through the factory and connects it, using
+// the connect() method so that subclasses of P4 get to see it.
+//
+
+PyObject * P4ConnectionPool::Create()
+{
+    PyObject * p4 = PyObject_CallObject( factory, NULL );
+    if( !p4 )
+	return NULL;
+
+    P4API_state * st = P4API_GetState();
+    if( !st ) {
+	Py_DECREF( p4 );
+	return NULL;
+    }
+
+    if( !PyObject_TypeCheck( p4, st->adapterType ) ) {
+	PyErr_SetString( PyExc_TypeError,
+		"Connection pool factory must return P4 instances" );
+	Py_DECREF( p4 );
+	return NULL;
+    }
+
+    PyObject * connected = ((P4Adapter *) p4)->clientAPI->Connected();
+    if( connected == Py_False ) {
+	Py_DECREF( connected );
+	connected = PyObject_CallMethod( p4, (char *) "connect", NULL );
+    }
+
+    if( !connected ) {
+	Py_DECREF( p4 );
+	return NULL;
+    }
+
+    Py_DECREF( connected );
+    return p4;
+}
+
+//
+// Checks that the connection has not been dropped by the server, and
+// reconnects it if it has. Like Create() it goes through the connect()
+// method. Returns -1 with an exception set on failure.
+//
+
+int P4ConnectionPool::Revive( PyObject * p4 )
+{
+    PythonClientAPI * api = ((P4Adapter *) p4)->clientAPI;
+
+    PyObject * connected = api->Connected();
+    if( connected == Py_True ) {
+	Py_DECREF( connected );
+	return 0;
+    }
+    Py_XDECREF( connected );
+
+    {
+	lock_guard<mutex> lock( poolLock );
+	reconnects++;
+    }
+
+    PyObject * result = PyObject_CallMethod( p4, (char *) "connect", NULL );
+    if( !result )
+	return -1;
+
+    Py_DECREF( result );
+    return 0;
+}
+
+// Callers hold poolLock
+
+bool P4ConnectionPool::CheckedOut( PyObject * p4 )
+{
+    return find( connections.begin(), connections.end(), p4 ) != connections.end()
+	&& find( idle.begin(), idle.end(), p4 ) == idle.end();
+}
+
+void P4ConnectionPool::Abandon( PyObject * p4 )
+{
+    PythonClientAPI * api = ((P4Adapter *) p4)->clientAPI;
+
+    LockPythonObject lock( p4 );
+    PyObject * result = api->IterAbandon();
+    Py_XDECREF( result );
+
+    if( PyErr_Occurred() )
+	PyErr_Clear();
+}
+
+void P4ConnectionPool::Disconnect( PyObject * p4 )
+{
+    PythonClientAPI * api = ((P4Adapter *) p4)->clientAPI;
+
+    PyObject * connected = api->Connected();
+    if( connected == Py_True ) {
+	PyObject * result = api->Disconnect();
+	Py_XDECREF( result );
+    }
+    Py_XDECREF( connected );
+
+    if( PyErr_Occurred() )
+	PyErr_Clear();
+}
+
+}
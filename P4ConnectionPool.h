@@ -0,0 +1,100 @@
+/*
+ * P4ConnectionPool. A fixed number of connections to the same server,
+ * shared between threads.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4ConnectionPool.h#1 $
+ *
+ */
+
+#ifndef P4CONNECTIONPOOL_H
+#define P4CONNECTIONPOOL_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace p4py
+{
+
+//
+// Hands out P4 objects created by a factory callable. Connections are
+// created and connected on demand, up to the size of the pool, and are
+// kept connected when they are returned, so each one is only set up
+// once. A connection that the server has dropped is reconnected when it
+// is next checked out.
+//
+// All methods must be called with the GIL held; Checkout() releases it
+// while waiting for a connection. The GIL is never acquired while the
+// internal mutex is held.
+//
+
+class P4ConnectionPool
+{
+public:
+
+    P4ConnectionPool( PyObject * factory, size_t size );
+    ~P4ConnectionPool();
+
+    // Returns a new reference, or NULL with an exception set. A negative
+    // timeout waits for as long as it takes.
+    PyObject *	Checkout( double timeout );
+
+    // Returns -1 with an exception set if p4 is not checked out
+    int		Checkin( PyObject * p4 );
+
+    // Disconnects the idle connections. Busy ones are disconnected when
+    // they are checked in; later checkouts fail.
+    void	Close();
+
+    PyObject *	Stats();
+
+private:
+    bool	IsClosed();
+    PyObject *	Create();
+    int		Revive( PyObject * p4 );
+    bool	CheckedOut( PyObject * p4 );
+    void	Abandon( PyObject * p4 );
+    void	Disconnect( PyObject * p4 );
+
+    PyObject *			factory;
+    size_t			capacity;
+    std::vector<PyObject *>	connections;	// all, owned references
+    std::deque<PyObject *>	idle;
+    size_t			creating;
+    bool			closed;
+
+    unsigned long		checkouts;
+    unsigned long		waits;
+    unsigned long		reconnects;
+
+    std::mutex			poolLock;
+    std::condition_variable	available;
+};
+}
+
+#endif
@@ -28,17 +28,25 @@ $Id$
 
 #include <Python.h>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
 
 #include <stdhdrs.h>
 #include <debug.h>
 
+#include "undefdups.h"
+#include "python2to3.h"
+
 #include "P4PythonDebug.h"
 #include "PythonThreadGuard.h"
 
 using namespace std;
 
 PythonDebug::PythonDebug()
-    : debugLevel(0)
+    : debugLevel(0),
+      traceNext(0),
+      traceCount(0)
 {
     Py_INCREF(Py_None);
     logger = Py_None;
@@ -86,6 +94,120 @@ void PythonDebug::printDebug(int minLevel, const char * text)
 }
 
 
+void PythonDebug::setTraceSize(int n)
+{
+    std::lock_guard<std::mutex> lock(traceLock);
+
+    ring.assign(n > 0 ? n : 0, TraceEvent());
+    traceNext = 0;
+    traceCount = 0;
+    traceStart = std::chrono::steady_clock::now();
+}
+
+//
+// Records an event. With a size given, the detail is taken to be that
+// many bytes of (not necessarily terminated) data.
+//
+
+void PythonDebug::addTrace(int level, const char * event, const char * detail,
+			   long size)
+{
+    std::lock_guard<std::mutex> lock(traceLock);
+
+    if( ring.empty() )
+	return;
+
+    TraceEvent & t = ring[traceNext];
+    t.time = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - traceStart).count();
+    t.level = level;
+    t.event = event;
+    t.size = size;
+    t.detail[0] = 0;
+
+    if( detail ) {
+	size_t len = size >= 0 ? (size_t) size : strlen(detail);
+	if( len >= sizeof(t.detail) )
+	    len = sizeof(t.detail) - 1;
+	memcpy(t.detail, detail, len);
+	t.detail[len] = 0;
+    }
+
+    traceNext = (traceNext + 1) % ring.size();
+    if( traceCount < ring.size() )
+	traceCount++;
+}
+
+// Returns the events in the ring, oldest first, as a list of dicts
+
+PyObject * PythonDebug::getTrace()
+{
+    std::lock_guard<std::mutex> lock(traceLock);
+
+    PyObject * list = PyList_New(0);
+    if( !list )
+	return NULL;
+
+    size_t first = (traceNext + ring.size() - traceCount) % (ring.size() ? ring.size() : 1);
+
+    for( size_t i = 0; i < traceCount; i++ ) {
+	TraceEvent & t = ring[(first + i) % ring.size()];
+
+	PyObject * detail = CreatePythonStringAndSize(t.detail, strlen(t.detail));
+	if( !detail ) {
+	    // Binary data need not decode, keep the raw bytes
+	    PyErr_Clear();
+	    detail = PyBytes_FromString(t.detail);
+	}
+
+	PyObject * event = detail ? Py_BuildValue("{s:d,s:i,s:s,s:l,s:N}",
+		"time", t.time,
+		"level", t.level,
+		"event", t.event,
+		"size", t.size,
+		"detail", detail) : NULL;
+
+	if( !event || PyList_Append(list, event) ) {
+	    Py_XDECREF(event);
+	    Py_DECREF(list);
+	    return NULL;
+	}
+	Py_DECREF(event);
+    }
+
+    return list;
+}
+
+// Writes the events in the ring to the logger (or stderr)
+
+void PythonDebug::dumpTrace()
+{
+    std::vector<TraceEvent> events;
+    {
+	std::lock_guard<std::mutex> lock(traceLock);
+
+	size_t first = (traceNext + ring.size() - traceCount) % (ring.size() ? ring.size() : 1);
+	for( size_t i = 0; i < traceCount; i++ )
+	    events.push_back(ring[(first + i) % ring.size()]);
+    }
+
+    for( size_t i = 0; i < events.size(); i++ ) {
+	TraceEvent & t = events[i];
+	stringstream s;
+	s << "[P4] trace " << fixed << setprecision(6) << t.time
+	  << " [" << t.level << "] " << t.event;
+	if( t.size >= 0 )
+	    s << " (" << t.size << ")";
+	if( t.detail[0] )
+	    s << " " << t.detail;
+
+	if( logger == Py_None )
+	    printDebug(s.str().c_str());
+	else
+	    callLogger("error", s.str().c_str());
+    }
+}
+
 void PythonDebug::callLogger(const char * method, const char * text)
 {
     EnsurePythonLock guard;
@@ -39,18 +39,59 @@
 # define P4PYDBG_GC		4
 # define P4PYDBG_RPC		9
 
+# include <vector>
+# include <mutex>
+# include <chrono>
+
 class PythonDebug
 {
 private:
     int debugLevel;
     PyObject * logger;
 
+    // One entry of the trace ring buffer. The event name must be a
+    // string literal, the detail is truncated to fit.
+    struct TraceEvent {
+	double		time;		// seconds since tracing started
+	int		level;
+	const char *	event;
+	long		size;
+	char		detail[ 96 ];
+    };
+
+    std::vector<TraceEvent> ring;
+    size_t traceNext;
+    size_t traceCount;
+    std::mutex traceLock;
+    std::chrono::steady_clock::time_point traceStart;
+
 public:
     PythonDebug();
 
     void setDebug(int d);
     int getDebug() const;
 
+    // Callers check this before formatting any debug output, so that
+    // nothing is built unless it is going to be printed
+    bool enabled(int minLevel) const { return debugLevel >= minLevel; }
+
+    //
+    // Trace ring buffer: keeps the last n events regardless of the debug
+    // level, to be looked at (or dumped) after an error. A size of 0
+    // disables it, which makes trace() a single test.
+    //
+    void setTraceSize(int n);
+    int getTraceSize() const { return (int) ring.size(); }
+    bool tracing() const { return !ring.empty(); }
+    void trace(int level, const char * event, const char * detail = 0,
+	       long size = -1)
+    {
+	if( tracing() )
+	    addTrace(level, event, detail, size);
+    }
+    PyObject * getTrace();
+    void dumpTrace();
+
     void setLogger(PyObject * l);
     PyObject * getLogger () const;
 
@@ -63,6 +104,7 @@ public:
     void printDebug(int minLevel, const char * text);
 
 private:
+    void addTrace(int level, const char * event, const char * detail, long size);
     void callLogger(const char * method, const char * text);
     void printDebug(const char * text);
 };
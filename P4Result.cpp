@@ -36,6 +36,8 @@ $Id: //depot/main/p4-python/P4Result.cpp#21 $
 #include "P4PythonDebug.h"
 #include "SpecMgr.h"
 #include "P4Result.h"
+#include "P4ResultQueue.h"
+#include "P4TrackStats.h"
 #include "PythonMessage.h"
 #include "P4PythonDebug.h"
 #include "PythonTypes.h"
@@ -53,10 +55,17 @@ P4Result::P4Result(PythonDebug * dbg, SpecMgr * s)
       errors(NULL),
       messages(NULL),
       track(NULL),
+      columns(NULL),
+      rows(0),
+      outputCount(0),
       specMgr(s),
       debug(dbg),
-      fatal(false)
+      queue(NULL),
+      fatal(false),
+      columnar(false)
 {
+    trackStats = new P4TrackStats;
+
     apiLevel = atoi( P4Tag::l_client );
 
     Reset();
@@ -85,10 +94,21 @@ P4Result::~P4Result()
     if (track) {
         Py_DECREF(track);
     }
+
+    Py_XDECREF(columns);
+
+    delete trackStats;
 }
 
 PyObject * P4Result::GetOutput()
 {   
+    if (columnar) {
+	PyObject * temp = columns ? columns : PyDict_New();
+	columns = NULL;
+	rows = 0;
+	return temp;
+    }
+
     PyObject * temp = output;
     output = NULL;  // last reference is removed by caller
     return temp;
@@ -121,6 +141,11 @@ P4Result::Reset()
         Py_DECREF(track);
     }
     track = PyList_New(0);
+    trackStats->Reset();
+
+    Py_CLEAR(columns);
+    rows = 0;
+    outputCount = 0;
 
     if (output == NULL
 	    || warnings == NULL
@@ -149,17 +174,26 @@ int P4Result::AppendString(PyObject * list, const char * str)
 
 int P4Result::AddOutput( const char *msg )
 {
-    return AppendString(output, msg);
+    PyObject *s = specMgr->CreatePyString(msg);
+    if (!s) {
+	return -1;
+    }
+    return AddOutput(s);
 }
 
-int P4Result::AddTrack( PyObject * t )
+int P4Result::AddTrack( const char * line, size_t len )
 {
+    PyObject *t = specMgr->CreatePyStringAndSize(line, len);
+    if (!t) {
+	return -1;
+    }
     if (PyList_Append(track, t) == -1) {
+	Py_DECREF(t);
     	return -1;
     }
     Py_DECREF(t);
 
-    return 0;
+    return trackStats->Parse(line, len);
 }
 
 void P4Result::ClearTrack()
@@ -168,10 +202,32 @@ void P4Result::ClearTrack()
         Py_DECREF(track);
     }
     track = PyList_New(0);
+    trackStats->Reset();
+}
+
+// Returns None unless the last command produced track output
+PyObject * P4Result::GetTrackStats()
+{
+    if (!track || !PyList_GET_SIZE(track)) {
+	Py_RETURN_NONE;
+    }
+    return trackStats->GetStats();
 }
 
 int P4Result::AddOutput( PyObject * out )
 {
+    outputCount++;
+
+    if (queue) {
+	return queue->Push(out);
+    }
+
+    if (columnar) {
+	int result = PyDict_Check(out) ? AddRowDict(out) : 0;
+	Py_DECREF(out);
+	return result;
+    }
+
     if (PyList_Append(output, out) == -1) {
     	return -1;
     }
@@ -180,6 +236,122 @@ int P4Result::AddOutput( PyObject * out )
     return 0;
 }
 
+//
+// Columnar output. Each column is a list holding one entry per row, with
+// None for rows that lack the field. Plain fields are scattered straight
+// from the StrDict; records with indexed fields (otherOpen0, depotFile0...)
+// are converted to a dict first so that they get the usual nesting.
+//
+
+int P4Result::AddRow( StrDict * dict )
+{
+    StrRef var, val;
+
+    outputCount++;
+
+    for( int i = 0; dict->GetVar(i, var, val); i++ ) {
+	const char c = var.Length() ? var.Text()[var.Length() - 1] : 0;
+	if( isdigit(c) || c == ',' ) {
+	    PyObject * d = specMgr->StrDictToDict(dict);
+	    if (!d) {
+		return -1;
+	    }
+	    int result = AddRowDict(d);
+	    Py_DECREF(d);
+	    return result;
+	}
+    }
+
+    for( int i = 0; dict->GetVar(i, var, val); i++ ) {
+	if( var == "specdef" || var == "func" || var == "specFormatted" )
+	    continue;
+
+	PyObject * key = specMgr->DictKey(var);
+	if (!key) {
+	    return -1;
+	}
+
+	PyObject * value = specMgr->CreateValue(key, &val);
+	int result = value ? AddColumnValue(key, value) : -1;
+	Py_XDECREF(value);
+	Py_DECREF(key);
+
+	if (result == -1) {
+	    return -1;
+	}
+    }
+
+    return EndRow();
+}
+
+int P4Result::AddRowDict( PyObject * dict )
+{
+    Py_ssize_t pos = 0;
+    PyObject *key, *value;
+
+    while (PyDict_Next(dict, &pos, &key, &value)) {
+	if (AddColumnValue(key, value) == -1) {
+	    return -1;
+	}
+    }
+
+    return EndRow();
+}
+
+int P4Result::AddColumnValue( PyObject * key, PyObject * value )
+{
+    if (!columns && !(columns = PyDict_New())) {
+	return -1;
+    }
+
+    PyObject * column = PyDict_GetItem(columns, key);
+
+    if (!column) {
+	// new column: earlier rows did not have this field
+	column = PyList_New(rows);
+	if (!column) {
+	    return -1;
+	}
+	for (Py_ssize_t i = 0; i < rows; i++) {
+	    Py_INCREF(Py_None);
+	    PyList_SET_ITEM(column, i, Py_None);
+	}
+	int result = PyDict_SetItem(columns, key, column);
+	Py_DECREF(column);
+	if (result == -1) {
+	    return -1;
+	}
+    }
+    else if (PyList_GET_SIZE(column) > rows) {
+	// repeated field within one row, keep the first value
+	return 0;
+    }
+
+    return PyList_Append(column, value);
+}
+
+int P4Result::EndRow()
+{
+    rows++;
+
+    if (!columns) {
+	return 0;
+    }
+
+    // pad the columns this row did not have a value for
+
+    Py_ssize_t pos = 0;
+    PyObject *key, *column;
+
+    while (PyDict_Next(columns, &pos, &key, &column)) {
+	if (PyList_GET_SIZE(column) < rows && PyList_Append(column, Py_None) == -1) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
 int
 P4Result::AddError( Error *e )
 {
@@ -217,10 +389,15 @@ P4Result::AddError( Error *e )
 	}
     }
 
-    P4Message * msg = (P4Message *) PyObject_New(P4Message, &P4MessageType);
+    P4API_state * st = P4API_GetState();
+    P4Message * msg = st ? PyObject_New(P4Message, st->messageType) : NULL;
+    if (!msg) {
+	return -1;
+    }
     msg->msg = new PythonMessage(e, specMgr);
 
     if (PyList_Append(messages, (PyObject *) msg) == -1) {
+	Py_DECREF(msg);
 	return -1;
     }
 
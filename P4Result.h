@@ -35,6 +35,9 @@
 namespace p4py
 {
 
+class P4ResultQueue;
+class P4TrackStats;
+
 class P4Result
 {
 public:
@@ -45,17 +48,28 @@ public:
     // Setting
     int         AddOutput( const char *msg );
     int         AddOutput( PyObject * out );
-    int	        AddTrack( PyObject * t );
+    int	        AddTrack( const char * line, size_t len );
     int         AddError( Error *e );
     void	ClearTrack();
     void	SetApiLevel( int level ) { apiLevel = level; }
 
+    // Streaming: output is handed to the queue instead of being collected
+    void	SetQueue( P4ResultQueue * q ) { queue = q; }
+    P4ResultQueue * GetQueue()		{ return queue; }
+
+    // Columnar mode: tagged output is collected as a dict of column
+    // lists instead of a list of dicts. Other output is discarded.
+    void	SetColumnar( bool c )	{ columnar = c; }
+    bool	IsColumnar()		{ return columnar; }
+    int		AddRow( StrDict * dict );
+
     // Getting
     PyObject *	GetOutput();
     PyObject *	GetErrors()     { Py_INCREF(errors); return errors;     }
     PyObject *	GetWarnings()   { Py_INCREF(warnings); return warnings; }
     PyObject *	GetMessages()   { Py_INCREF(messages); return messages; }
     PyObject *	GetTrack()	{ Py_INCREF(track); return track; }
+    PyObject *	GetTrackStats();
 
     // Get errors/warnings as a formatted string
     void        FmtErrors( StrBuf &buf );
@@ -64,6 +78,7 @@ public:
     // Testing
     int         ErrorCount();
     int         WarningCount();
+    unsigned long OutputCount()	{ return outputCount; }
     bool	FatalError() { return fatal; }
 
     // Clear previous results
@@ -76,16 +91,25 @@ private:
     int         Length( PyObject * ary );
     void        Fmt( const char *label, PyObject * list, StrBuf &buf );
     int		AppendString(PyObject * list, const char * str);
+    int		AddColumnValue( PyObject * key, PyObject * value );
+    int		AddRowDict( PyObject * dict );
+    int		EndRow();
 
     PyObject *	  output;
     PyObject *	  warnings;
     PyObject *	  errors;
     PyObject *	  messages;
     PyObject *	  track;
+    PyObject *	  columns;
+    P4TrackStats * trackStats;
+    Py_ssize_t	  rows;
+    unsigned long outputCount;	// results added since the last Reset()
     SpecMgr *	  specMgr;
     PythonDebug * debug;
+    P4ResultQueue * queue;
     int           apiLevel;
     bool	  fatal;
+    bool	  columnar;
 };
 }
 
@@ -0,0 +1,206 @@
+/*******************************************************************************
+
+Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+IBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+$Id: //depot/main/p4-python/P4ResultQueue.cpp#1 $
+*******************************************************************************/
+
+#include <Python.h>
+#include "PythonThreadGuard.h"
+#include "P4ResultQueue.h"
+
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace p4py {
+
+P4ResultQueue::P4ResultQueue( size_t cap )
+    : capacity( cap ? cap : 1 ),
+      peak( 0 ),
+      done( false ),
+      closed( false ),
+      notifyFd( -1 )
+{
+}
+
+P4ResultQueue::~P4ResultQueue()
+{
+    Clear();
+}
+
+int P4ResultQueue::Push( PyObject * item )
+{
+    bool pushed;
+
+    for( ;; ) {
+	{
+	    lock_guard<mutex> lock( queueLock );
+
+	    pushed = !closed && items.size() < capacity;
+	    if( pushed ) {
+		items.push_back( item );
+		if( items.size() > peak )
+		    peak = items.size();
+		notEmpty.notify_one();
+	    }
+	}
+
+	if( pushed ) {
+	    Notify();
+	    return 0;
+	}
+
+	if( IsClosed() ) {
+	    Py_DECREF( item );
+	    return -1;
+	}
+
+	// Queue is full: wait for the consumer without holding the GIL
+
+	ReleasePythonLock guard;
+	unique_lock<mutex> lock( queueLock );
+	notFull.wait( lock, [this] { return closed || items.size() < capacity; } );
+    }
+}
+
+PyObject * P4ResultQueue::Pop()
+{
+    for( ;; ) {
+	{
+	    lock_guard<mutex> lock( queueLock );
+
+	    if( !items.empty() ) {
+		PyObject * item = items.front();
+		items.pop_front();
+		notFull.notify_one();
+		return item;
+	    }
+
+	    if( done || closed )
+		return NULL;
+	}
+
+	ReleasePythonLock guard;
+	unique_lock<mutex> lock( queueLock );
+	notEmpty.wait( lock, [this] { return done || closed || !items.empty(); } );
+    }
+}
+
+int P4ResultQueue::TryPop( PyObject ** item )
+{
+    lock_guard<mutex> lock( queueLock );
+
+    if( !items.empty() ) {
+	*item = items.front();
+	items.pop_front();
+	notFull.notify_one();
+	return 1;
+    }
+
+    return done || closed ? -1 : 0;
+}
+
+void P4ResultQueue::Done()
+{
+    {
+	lock_guard<mutex> lock( queueLock );
+	done = true;
+	notEmpty.notify_all();
+    }
+    Notify();
+}
+
+void P4ResultQueue::Close()
+{
+    {
+	lock_guard<mutex> lock( queueLock );
+	closed = true;
+	notFull.notify_all();
+	notEmpty.notify_all();
+    }
+    Clear();
+}
+
+bool P4ResultQueue::IsClosed()
+{
+    lock_guard<mutex> lock( queueLock );
+    return closed;
+}
+
+size_t P4ResultQueue::Peak()
+{
+    lock_guard<mutex> lock( queueLock );
+    return peak;
+}
+
+void P4ResultQueue::SetNotify( int fd )
+{
+    lock_guard<mutex> lock( queueLock );
+    notifyFd = fd;
+}
+
+//
+// The reader only needs to know that something has changed, so a write
+// that fails because the pipe is full is harmless. The descriptor should
+// be non-blocking.
+//
+
+void P4ResultQueue::Notify()
+{
+    int fd;
+    {
+	lock_guard<mutex> lock( queueLock );
+	fd = notifyFd;
+    }
+
+    if( fd < 0 )
+	return;
+
+    char c = 0;
+#ifdef _WIN32
+    (void) send( (SOCKET) fd, &c, 1, 0 );
+#else
+    (void) !write( fd, &c, 1 );
+#endif
+}
+
+void P4ResultQueue::Clear()
+{
+    deque<PyObject *> pending;
+    {
+	lock_guard<mutex> lock( queueLock );
+	pending.swap( items );
+    }
+
+    for( size_t i = 0; i < pending.size(); i++ )
+	Py_DECREF( pending[ i ] );
+}
+
+}
@@ -0,0 +1,105 @@
+/*
+ * P4ResultQueue. Bounded hand-over queue between the thread running a
+ * command and the Python iterator consuming its results.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4ResultQueue.h#1 $
+ *
+ */
+
+#ifndef P4RESULTQUEUE_H
+#define P4RESULTQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace p4py
+{
+
+//
+// A bounded FIFO of Python objects. The producer is the thread running
+// ClientApi::Run() (inside the ClientUser callbacks), the consumer is the
+// Python thread iterating over the results.
+//
+// Both Push() and Pop() must be called with the GIL held. Whenever they
+// have to wait they release the GIL first, so a full queue throttles the
+// server thread without stalling the rest of the interpreter. The GIL is
+// never acquired while the internal mutex is held.
+//
+
+class P4ResultQueue
+{
+public:
+
+    P4ResultQueue( size_t capacity );
+    ~P4ResultQueue();
+
+    // Steals the reference. Returns -1 if the queue has been closed,
+    // in which case the object is simply released.
+    int		Push( PyObject * item );
+
+    // Returns a new reference, or NULL once the producer is done and
+    // the queue has been drained.
+    PyObject *	Pop();
+
+    // Does not wait: returns 1 and a new reference in item if there is
+    // one, 0 if the producer may still push more, -1 once the producer
+    // is done and the queue has been drained.
+    int		TryPop( PyObject ** item );
+
+    // Producer side: no more items will follow
+    void	Done();
+
+    // Consumer side: not interested in any more items
+    void	Close();
+
+    bool	IsClosed();
+
+    // The most items that were waiting in the queue at one time
+    size_t	Peak();
+
+    // A byte is written to fd whenever an item is pushed and when the
+    // producer is done, so that an event loop can wait for the queue.
+    void	SetNotify( int fd );
+
+private:
+    void	Clear();
+    void	Notify();
+
+    std::deque<PyObject *>	items;
+    std::mutex			queueLock;
+    std::condition_variable	notEmpty;
+    std::condition_variable	notFull;
+    size_t			capacity;
+    size_t			peak;
+    bool			done;
+    bool			closed;
+    int				notifyFd;
+};
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * P4StatArena. Native storage for tagged output collected while the GIL
+ * is released.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4StatArena.cpp#1 $
+ */
+
+#include <Python.h>
+#include "undefdups.h"
+#include "python2to3.h"
+#include <clientapi.h>
+
+#include "P4StatArena.h"
+
+namespace p4py {
+
+P4StatArena::P4StatArena()
+{
+    view.arena = this;
+}
+
+void P4StatArena::Add( StrDict * values )
+{
+    StrRef var, val;
+
+    records.push_back( fields.size() );
+
+    for( int i = 0; values->GetVar( i, var, val ); i++ ) {
+	Field f;
+	f.var = Store( var );
+	f.varLen = var.Length();
+	f.val = Store( val );
+	f.valLen = val.Length();
+	fields.push_back( f );
+    }
+}
+
+//
+// Strings are kept null terminated, as the conversion code expects
+// StrPtr::Text() to be a C string.
+//
+
+size_t P4StatArena::Store( const StrPtr &s )
+{
+    size_t offset = strings.Length();
+
+    strings.Append( s.Text(), s.Length() );
+    strings.Extend( '\0' );
+
+    return offset;
+}
+
+StrDict * P4StatArena::Get( int i )
+{
+    view.first = records[i];
+    view.count = ( (size_t) i + 1 < records.size() ? records[i + 1]
+						 : fields.size() ) - view.first;
+    return &view;
+}
+
+void P4StatArena::Clear()
+{
+    strings.Clear();
+    fields.clear();
+    records.clear();
+}
+
+StrPtr * P4StatArena::Record::VGetVar( const StrPtr &var )
+{
+    for( size_t i = first; i < first + count; i++ ) {
+	const Field & f = arena->fields[i];
+	const char * name = arena->strings.Text() + f.var;
+
+	if( f.varLen == var.Length() && !memcmp( name, var.Text(), f.varLen ) ) {
+	    found.Set( arena->strings.Text() + f.val, f.valLen );
+	    return &found;
+	}
+    }
+    return 0;
+}
+
+int P4StatArena::Record::VGetVarX( int x, StrRef &var, StrRef &val )
+{
+    if( x < 0 || (size_t) x >= count )
+	return 0;
+
+    const Field & f = arena->fields[first + x];
+    var.Set( arena->strings.Text() + f.var, f.varLen );
+    val.Set( arena->strings.Text() + f.val, f.valLen );
+    return 1;
+}
+}
@@ -0,0 +1,102 @@
+/*
+ * P4StatArena. Native storage for tagged output collected while the GIL
+ * is released.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4StatArena.h#1 $
+ */
+
+#ifndef P4STATARENA_H
+#define P4STATARENA_H
+
+#include <vector>
+
+namespace p4py
+{
+
+//
+// Copies of tagged output records that do not involve any Python objects,
+// so they can be taken while the GIL is released. The strings of all
+// records share one buffer and each field only records where its name
+// and value start, so adding a record rarely allocates once the arena
+// has grown to the size of a chunk. Clear() keeps the memory for the
+// next chunk.
+//
+
+class P4StatArena
+{
+public:
+
+    P4StatArena();
+
+    // Copies all the variables of values
+    void	Add( StrDict * values );
+
+    // Returns a view of record i. It stays valid until the next call
+    // of Get(), Add() or Clear().
+    StrDict *	Get( int i );
+
+    int		Count() const { return (int) records.size(); }
+
+    void	Clear();
+
+private:
+
+    struct Field
+    {
+	size_t		var;
+	size_t		val;
+	p4size_t	varLen;
+	p4size_t	valLen;
+    };
+
+    class Record : public StrDict
+    {
+    public:
+	Record() : arena( 0 ), first( 0 ), count( 0 ) {}
+
+	P4StatArena *	arena;
+	size_t		first;
+	size_t		count;
+
+    protected:
+	StrPtr *	VGetVar( const StrPtr &var );
+	int		VGetVarX( int x, StrRef &var, StrRef &val );
+
+    private:
+	StrRef		found;
+    };
+
+    size_t	Store( const StrPtr &s );
+
+    StrBuf		strings;
+    std::vector<Field>	fields;
+    std::vector<size_t>	records;	// first field of each record
+    Record		view;
+};
+}
+
+#endif
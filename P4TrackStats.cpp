@@ -0,0 +1,238 @@
+/*
+ * P4TrackStats. Turns the performance data that the server sends in
+ * track mode into nested dicts.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4TrackStats.cpp#1 $
+ *
+ */
+
+#include <Python.h>
+#include "undefdups.h"
+#include "python2to3.h"
+#include <clientapi.h>
+
+#include "P4TrackStats.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+namespace p4py {
+
+P4TrackStats::P4TrackStats()
+    : stats( NULL ),
+      table( NULL )
+{
+}
+
+P4TrackStats::~P4TrackStats()
+{
+    Py_XDECREF( stats );
+}
+
+void P4TrackStats::Reset()
+{
+    Py_CLEAR( stats );
+    table = NULL;
+}
+
+int P4TrackStats::Init()
+{
+    if( stats )
+	return 0;
+
+    stats = Py_BuildValue( "{s:O,s:{},s:{},s:{},s:[]}",
+	    "lapse", Py_None,
+	    "usage",
+	    "rpc",
+	    "tables",
+	    "other" );
+
+    return stats ? 0 : -1;
+}
+
+PyObject * P4TrackStats::GetStats()
+{
+    if( Init() )
+	return NULL;
+
+    Py_INCREF( stats );
+    return stats;
+}
+
+int P4TrackStats::Parse( const char * text, size_t len )
+{
+    if( Init() )
+	return -1;
+
+    StrBuf line;
+    line.Set( text, (p4size_t) len );
+
+    if( line.Text()[0] == ' ' )
+	return table ? ParseTable( line.Text() ) :
+		       AddOther( stats, line.Text() );
+
+    table = NULL;
+    return ParseCommand( line.Text() );
+}
+
+//
+// Copies the entries of values (a new reference) into dict
+//
+
+int P4TrackStats::SetValues( PyObject * dict, PyObject * values )
+{
+    if( !values )
+	return -1;
+
+    int result = PyDict_Update( dict, values );
+    Py_DECREF( values );
+    return result;
+}
+
+int P4TrackStats::AddOther( PyObject * dict, const char * line )
+{
+    PyObject * other = PyDict_GetItemString( dict, "other" );
+    if( !other ) {
+	other = PyList_New( 0 );
+	if( !other || PyDict_SetItemString( dict, "other", other ) ) {
+	    Py_XDECREF( other );
+	    return -1;
+	}
+	Py_DECREF( other );
+    }
+
+    PyObject * s = CreatePythonString( line, "" );
+    if( !s )
+	return -1;
+
+    int result = PyList_Append( other, s );
+    Py_DECREF( s );
+    return result;
+}
+
+int P4TrackStats::ParseCommand( const char * line )
+{
+    double d1, d2;
+    long l[ 8 ];
+
+    if( sscanf( line, "lapse %lfs", &d1 ) == 1 ) {
+	PyObject * lapse = PyFloat_FromDouble( d1 );
+	if( !lapse )
+	    return -1;
+
+	int result = PyDict_SetItemString( stats, "lapse", lapse );
+	Py_DECREF( lapse );
+	return result;
+    }
+
+    if( sscanf( line, "usage %ld+%ldus %ld+%ldio %ld+%ldnet %ldk %ldpf",
+		&l[0], &l[1], &l[2], &l[3], &l[4], &l[5], &l[6], &l[7] ) == 8 )
+	return SetValues( PyDict_GetItemString( stats, "usage" ),
+		Py_BuildValue( "{s:l,s:l,s:l,s:l,s:l,s:l,s:l,s:l}",
+		    "user_ms", l[0], "system_ms", l[1],
+		    "io_in", l[2], "io_out", l[3],
+		    "net_in", l[4], "net_out", l[5],
+		    "max_rss_kb", l[6], "page_faults", l[7] ) );
+
+    if( sscanf( line, "rpc msgs/size in+out %ld+%ld/%ldmb+%ldmb "
+		"himarks %ld/%ld snd/rcv %lfs/%lfs",
+		&l[0], &l[1], &l[2], &l[3], &l[4], &l[5], &d1, &d2 ) == 8 )
+	return SetValues( PyDict_GetItemString( stats, "rpc" ),
+		Py_BuildValue( "{s:l,s:l,s:l,s:l,s:l,s:l,s:d,s:d}",
+		    "msgs_in", l[0], "msgs_out", l[1],
+		    "mb_in", l[2], "mb_out", l[3],
+		    "himark_fwd", l[4], "himark_rev", l[5],
+		    "send_time", d1, "receive_time", d2 ) );
+
+    //
+    // A line without blanks names a table (db.have, clients/x(W), ...)
+    // whose statistics follow indented.
+    //
+    if( !strchr( line, ' ' ) ) {
+	PyObject * t = PyDict_New();
+	if( !t )
+	    return -1;
+
+	int result = PyDict_SetItemString(
+		PyDict_GetItemString( stats, "tables" ), line, t );
+	Py_DECREF( t );
+
+	if( !result )
+	    table = t;
+	return result;
+    }
+
+    return AddOther( stats, line );
+}
+
+int P4TrackStats::ParseTable( const char * line )
+{
+    long l[ 7 ];
+
+    while( *line == ' ' )
+	line++;
+
+    if( sscanf( line, "pages in+out+cached %ld+%ld+%ld",
+		&l[0], &l[1], &l[2] ) == 3 )
+	return SetValues( table, Py_BuildValue( "{s:l,s:l,s:l}",
+		"pages_in", l[0], "pages_out", l[1], "pages_cached", l[2] ) );
+
+    if( sscanf( line, "locks read/write %ld/%ld rows get+pos+scan put+del "
+		"%ld+%ld+%ld %ld+%ld", &l[0], &l[1], &l[2], &l[3], &l[4],
+		&l[5], &l[6] ) == 7 )
+	return SetValues( table, Py_BuildValue(
+		"{s:l,s:l,s:l,s:l,s:l,s:l,s:l}",
+		"locks_read", l[0], "locks_write", l[1],
+		"rows_get", l[2], "rows_pos", l[3], "rows_scan", l[4],
+		"rows_put", l[5], "rows_del", l[6] ) );
+
+    const char * kind = 0;
+    if( !strncmp( line, "total ", 6 ) )
+	kind = "total";
+    else if( !strncmp( line, "max ", 4 ) )
+	kind = "max";
+
+    if( kind && sscanf( line + strlen( kind ),
+		" lock wait+held read/write %ldms+%ldms/%ldms+%ldms",
+		&l[0], &l[1], &l[2], &l[3] ) == 4 ) {
+	StrBuf rw, rh, ww, wh;
+	rw << kind << "_read_wait_ms";
+	rh << kind << "_read_held_ms";
+	ww << kind << "_write_wait_ms";
+	wh << kind << "_write_held_ms";
+
+	return SetValues( table, Py_BuildValue( "{s:l,s:l,s:l,s:l}",
+		rw.Text(), l[0], rh.Text(), l[1],
+		ww.Text(), l[2], wh.Text(), l[3] ) );
+    }
+
+    return AddOther( table, line );
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * P4TrackStats. Turns the performance data that the server sends in
+ * track mode into nested dicts.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ * 
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * $Id: //depot/main/p4-python/P4TrackStats.h#1 $
+ *
+ */
+
+#ifndef P4TRACKSTATS_H
+#define P4TRACKSTATS_H
+
+namespace p4py
+{
+
+//
+// Parses the track lines of a command, with the leading "--- " already
+// removed, one at a time:
+//
+//	lapse .044s
+//	usage 10+20us 0+8io 0+0net 4960k 0pf
+//	rpc msgs/size in+out 2+3/0mb+0mb himarks 795/2000 snd/rcv .000s/.000s
+//	db.counters
+//	  pages in+out+cached 6+0+2
+//	  locks read/write 1/0 rows get+pos+scan put+del 1+0+0 0+0
+//	  total lock wait+held read/write 0ms+0ms/0ms+0ms
+//	  max lock wait+held read/write 0ms+0ms/0ms+0ms
+//
+// The result has the keys lapse, usage, rpc and tables, the latter with
+// one dict per table. Lines that are not understood are kept as strings
+// in the list "other" of the table they belong to, or of the result.
+// All methods must be called with the GIL held.
+//
+
+class P4TrackStats
+{
+public:
+
+    P4TrackStats();
+    ~P4TrackStats();
+
+    // Returns -1 with an exception set on failure
+    int		Parse( const char * line, size_t len );
+
+    // Returns a new reference to the dict, which is created on demand
+    PyObject *	GetStats();
+
+    void	Reset();
+
+private:
+    int		ParseCommand( const char * line );
+    int		ParseTable( const char * line );
+    int		SetValues( PyObject * dict, PyObject * values );
+    int		AddOther( PyObject * dict, const char * line );
+    int		Init();
+
+    PyObject *	stats;
+    PyObject *	table;		// borrowed, the table being parsed
+};
+}
+
+#endif
@@ -47,6 +47,7 @@ $Id: //depot/main/p4-python/PythonClientAPI.cpp#82 $
 #include "P4PythonDebug.h"
 #include "SpecMgr.h"
 #include "P4Result.h"
+#include "P4ResultQueue.h"
 #include "PythonClientUser.h"
 #include "PythonClientAPI.h"
 #include "P4PythonDebug.h"
@@ -77,6 +78,15 @@ PythonClientAPI::PythonClientAPI()
     maxLockTime = 0;
     maxOpenFiles = 0;
     maxMemory = 0;
+    keepAlive = NULL;
+    iterBuffer = 1000;
+    iterCount = 0;
+    iterActive = 0;
+    iterOwner = NULL;
+    iterInterp = NULL;
+    iterThread = NULL;
+    iterQueue = NULL;
+    iterErrType = iterErrValue = iterErrTb = NULL;
     prog = "unnamed p4-python script";
     apiLevel = atoi( P4Tag::l_client );
     enviro = new Enviro;
@@ -123,6 +133,9 @@ PythonClientAPI::~PythonClientAPI()
     // can't use logger here, probably already destructed at this time
     debug.printDebug(P4PYDBG_GC, "Destructor PythonClientAPI::~PythonClientAPI called");
 
+    if( iterActive )
+	IterFinish( true );
+
     if( IsConnected() ) {
 	Error e;
 	client.Final( &e );
@@ -161,8 +174,17 @@ PythonClientAPI::intattribute_t PythonClientAPI::intattributes[] = {
 	{ "maxlocktime",	&PythonClientAPI::SetMaxLockTime,	&PythonClientAPI::GetMaxLockTime },
 	{ "maxopenfiles",	&PythonClientAPI::SetMaxOpenFiles,	&PythonClientAPI::GetMaxOpenFiles },
 	{ "maxmemory",	&PythonClientAPI::SetMaxMemory,	&PythonClientAPI::GetMaxMemory },
+	{ "iter_buffer",	&PythonClientAPI::SetIterBuffer,	&PythonClientAPI::GetIterBuffer },
+	{ "value_cache_size",	&PythonClientAPI::SetValueCacheSize,	&PythonClientAPI::GetValueCacheSize },
+	{ "columnar",		&PythonClientAPI::SetColumnar,		&PythonClientAPI::GetColumnar },
+	{ "lazy_records",	&PythonClientAPI::SetLazyRecords,	&PythonClientAPI::GetLazyRecords },
+	{ "stat_chunk",		&PythonClientAPI::SetStatChunk,		&PythonClientAPI::GetStatChunk },
+	{ "typed",		&PythonClientAPI::SetTyped,		&PythonClientAPI::GetTyped },
+	{ "assemble_print",	&PythonClientAPI::SetAssemblePrint,	&PythonClientAPI::GetAssemblePrint },
+	{ "diff_per_file",	&PythonClientAPI::SetDiffPerFile,	&PythonClientAPI::GetDiffPerFile },
 	{ "exception_level",	&PythonClientAPI::SetExceptionLevel,	&PythonClientAPI::GetExceptionLevel },
 	{ "debug",		&PythonClientAPI::SetDebug,		&PythonClientAPI::GetDebug },
+	{ "trace_size",		&PythonClientAPI::SetTraceSize,		&PythonClientAPI::GetTraceSize },
 	{ "track",		&PythonClientAPI::SetTrack,		&PythonClientAPI::GetTrack },
 	{ "streams",		&PythonClientAPI::SetStreams,		&PythonClientAPI::GetStreams },
 	{ "graph",		&PythonClientAPI::SetGraph,		&PythonClientAPI::GetGraph },
@@ -181,6 +203,7 @@ PythonClientAPI::strattribute_t PythonClientAPI::strattributes[] = {
 	{ "language",		&PythonClientAPI::SetLanguage,		&PythonClientAPI::GetLanguage },
 	{ "port",		&PythonClientAPI::SetPort,		&PythonClientAPI::GetPort },
 	{ "prog",		&PythonClientAPI::SetProg,		&PythonClientAPI::GetProg },
+	{ "spec_cache",		&PythonClientAPI::SetSpecCache,		&PythonClientAPI::GetSpecCache },
 	{ "ticket_file",	&PythonClientAPI::SetTicketFile,	&PythonClientAPI::GetTicketFile },
 	{ "password",		&PythonClientAPI::SetPassword,		&PythonClientAPI::GetPassword },
 	{ "user",		&PythonClientAPI::SetUser,		&PythonClientAPI::GetUser },
@@ -197,12 +220,21 @@ PythonClientAPI::objattribute_t PythonClientAPI::objattributes[] = {
 	{ "input",		&PythonClientAPI::SetInput,		&PythonClientAPI::GetInput },
         { "resolver",           &PythonClientAPI::SetResolver,          &PythonClientAPI::GetResolver },
         { "handler",            &PythonClientAPI::SetHandler,           &PythonClientAPI::GetHandler },
+	{ "print_target",	&PythonClientAPI::SetPrintTarget,	&PythonClientAPI::GetPrintTarget },
         { "progress",           &PythonClientAPI::SetProgress,          &PythonClientAPI::GetProgress },
         { "errors",		NULL,					&PythonClientAPI::GetErrors },
 	{ "warnings",		NULL,					&PythonClientAPI::GetWarnings },
         { "messages",		NULL,					&PythonClientAPI::GetMessages },
 	{ "p4config_files",	NULL,					&PythonClientAPI::GetConfigFiles },
 	{ "track_output",	NULL,					&PythonClientAPI::GetTrackOutput },
+	{ "track_stats",	NULL,					&PythonClientAPI::GetTrackStats },
+	{ "last_command_stats",	NULL,					&PythonClientAPI::GetLastCommandStats },
+	{ "trace_events",	NULL,					&PythonClientAPI::GetTraceEvents },
+	{ "key_cache_stats",	NULL,					&PythonClientAPI::GetKeyCacheStats },
+	{ "spec_cache_stats",	NULL,					&PythonClientAPI::GetSpecCacheStats },
+	{ "value_cache_fields",	&PythonClientAPI::SetValueCacheFields,	&PythonClientAPI::GetValueCacheFields },
+	{ "value_cache_stats",	NULL,					&PythonClientAPI::GetValueCacheStats },
+	{ "typed_fields",	&PythonClientAPI::SetTypedFields,	&PythonClientAPI::GetTypedFields },
 	{ "__members__",	NULL,					&PythonClientAPI::GetMembers },
 	{ "server_level",	NULL,					&PythonClientAPI::GetServerLevel },
 	{ "server_case_insensitive",	NULL,				&PythonClientAPI::GetServerCaseInsensitive },
@@ -400,7 +432,7 @@ int PythonClientAPI::GetTagged()
 int PythonClientAPI::SetTrack( int enable )
 {
     if ( IsConnected() ) {
-	PyErr_SetString(P4Error, "Can't change tracking once you've connected.");
+	PyErr_SetString(P4API_ErrorType(), "Can't change tracking once you've connected.");
 	return -1;
     }
     else {
@@ -545,15 +577,28 @@ int PythonClientAPI::SetApiLevel( int level )
 int PythonClientAPI::SetPort( const char *p ) 
 {
     if ( IsConnected() ) {
-	PyErr_SetString(P4Error, "Can't change port once you've connected."); 
+	PyErr_SetString(P4API_ErrorType(), "Can't change port once you've connected."); 
 	return -1;
     }
     else {
 	client.SetPort( p );
+	specMgr.SetSpecCacheServer( client.GetPort().Text() );
 	return 0; 
     }
 }
 
+//
+// Directory for specdefs kept across processes, keyed by server address.
+// See SpecMgr::SetSpecCache().
+//
+
+int PythonClientAPI::SetSpecCache( const char *d )
+{
+    specMgr.SetSpecCache( d );
+    specMgr.SetSpecCacheServer( client.GetPort().Text() );
+    return 0;
+}
+
 const char * PythonClientAPI::GetEnv( const char *var )
 {
     return enviro->Get( var );
@@ -721,12 +766,15 @@ PyObject * PythonClientAPI::ConnectOrReconnect()
     if ( e.Test() )
 	Py_RETURN_FALSE;
 
+    // P4PORT may have come from a P4CONFIG file
+    specMgr.SetSpecCacheServer( client.GetPort().Text() );
+
     // If an iterator is defined, reset the break functionality
     // for the KeepAlive function
 
     if( ui.GetHandler() != Py_None )
     {
-	client.SetBreak( &ui );
+	SetKeepAlive( &ui );
     }
 
     SetConnected();
@@ -755,6 +803,10 @@ PyObject * PythonClientAPI::Disconnect()
 	Py_RETURN_NONE;
     }
     
+    // Abandon any command still streaming its results
+    if( iterActive )
+	IterFinish( true );
+
     Error	e;
 
     {
@@ -773,15 +825,20 @@ PyObject * PythonClientAPI::Disconnect()
     Py_RETURN_NONE;
 }
 
-PyObject * PythonClientAPI::Run( const char *cmd, int argc, char * const *argv )
+static void FmtCommand( StrBuf &cmdString, const char *cmd, int argc, char * const *argv )
 {
-    // Save the entire command string for our error messages. Makes it
-    // easy to see where a script has gone wrong.
-    StrBuf	cmdString;
     cmdString << "\"p4 " << cmd;
     for( int i = 0; i < argc; i++ )
         cmdString << " " << argv[ i ];
     cmdString << "\"";
+}
+
+PyObject * PythonClientAPI::Run( const char *cmd, int argc, char * const *argv )
+{
+    // Save the entire command string for our error messages. Makes it
+    // easy to see where a script has gone wrong.
+    StrBuf	cmdString;
+    FmtCommand( cmdString, cmd, argc, argv );
 
     StrBuf buf("[P4] Executing ");
     buf << cmdString;
@@ -800,6 +857,7 @@ PyObject * PythonClientAPI::Run( const char *cmd, int argc, char * const *argv )
 
     // Tell the UI which command we're running.
     ui.SetCommand( cmd );
+    specMgr.SetCommand( cmd );
 
     if ( ! IsConnected() && exceptionLevel ) {
 	Except( "P4.run()", "not connected." );
@@ -813,6 +871,22 @@ PyObject * PythonClientAPI::Run( const char *cmd, int argc, char * const *argv )
     RunCmd( cmd, &ui, argc, argv );
     depth--;
 
+    SaveStats();
+
+    if( !CheckResults( cmdString.Text() ) )
+	return NULL;
+
+    return ui.GetResults().GetOutput();
+}
+
+//
+// Deals with the aftermath of a command: reconnects if a handler cancelled
+// it, and raises errors and warnings according to the exception level.
+// Returns false if an exception has been set.
+//
+
+bool PythonClientAPI::CheckResults( const char *cmdString )
+{
     PyObject *handler = ui.GetHandler();
     Py_DECREF(handler);
     if( handler != Py_None ) {
@@ -822,26 +896,490 @@ PyObject * PythonClientAPI::Run( const char *cmd, int argc, char * const *argv )
 	}
 
 	if( PyErr_Occurred() )
-	    return NULL;
+	    return false;
     }
 
     p4py::P4Result &results = ui.GetResults();
 
     if ( results.ErrorCount() && exceptionLevel ) {
-	Except( "P4#run", "Errors during command execution", cmdString.Text() );
+	Except( "P4#run", "Errors during command execution", cmdString );
 
 	if( results.FatalError() )
 	    Disconnect();
 
-	return NULL;
+	return false;
     }
 
     if ( results.WarningCount() && exceptionLevel > 1 ) {
-	Except( "P4#run", "Warnings during command execution",cmdString.Text());
+	Except( "P4#run", "Warnings during command execution", cmdString );
+	return false;
+    }
+
+    return true;
+}
+
+//
+// Timings of the last command. The time in ClientApi::Run() is split up
+// into the time spent waiting for the server (or the network), the time
+// converting results with the GIL held and the time in Python callbacks.
+//
+
+PyObject * PythonClientAPI::GetLastCommandStats()
+{
+    p4py::P4CommandStats & s = lastStats;
+
+    double wait = s.runTime - s.gilTime;
+    double convert = s.gilTime - s.callbackTime;
+
+    return Py_BuildValue( "{s:s,s:d,s:d,s:d,s:d,s:k,s:k,s:k,s:k,s:k,s:K,s:k,s:k}",
+	    "command",		lastCommand.Text(),
+	    "run_time",		s.runTime,
+	    "wait_time",	wait > 0.0 ? wait : 0.0,
+	    "convert_time",	convert > 0.0 ? convert : 0.0,
+	    "callback_time",	s.callbackTime,
+	    "stat_records",	s.statRecords,
+	    "text_records",	s.textRecords,
+	    "binary_records",	s.binaryRecords,
+	    "info_records",	s.infoRecords,
+	    "messages",		s.messages,
+	    "bytes",		s.bytes,
+	    "results",		s.results,
+	    "peak_result_count",	s.peakResults );
+}
+
+//
+// Keeps the figures of a command once it has finished, so that a streamed
+// command still updating them is never seen half way. A plain command
+// holds all of its results at the end; a streamed one at most what was
+// waiting in the queue.
+//
+
+void PythonClientAPI::SaveStats()
+{
+    lastStats = ui.GetStats();
+    lastStats.results = ui.GetResults().OutputCount();
+
+    p4py::P4ResultQueue * q = ui.GetResults().GetQueue();
+    lastStats.peakResults = q ? q->Peak() : lastStats.results;
+
+    lastCommand = ui.GetCommand();
+}
+
+PyObject * PythonClientAPI::RunIter( PyObject *owner, const char *cmd, int argc, char * const *argv )
+{
+    StrBuf	cmdString;
+    FmtCommand( cmdString, cmd, argc, argv );
+
+    StrBuf buf("[P4] Streaming ");
+    buf << cmdString;
+
+    debug.info ( buf.Text() );
+
+    if ( depth )
+    {
+    	(void) PyErr_WarnEx( PyExc_UserWarning, 
+		"P4.run() - Can't execute nested Perforce commands.", 1 );
+	Py_RETURN_FALSE;
+    }
+
+    ui.Reset();
+    ui.SetCommand( cmd );
+    specMgr.SetCommand( cmd );
+
+    if ( ! IsConnected() && exceptionLevel ) {
+	Except( "P4.run()", "not connected." );
+	return NULL;
+    }
+    
+    if ( ! IsConnected()  )
+	Py_RETURN_FALSE;
+
+    P4API_state * st = P4API_GetState();
+    P4ResultIterator * iter = st ? PyObject_New(P4ResultIterator, st->resultIteratorType) : NULL;
+    if( !iter )
+	return NULL;
+
+    Py_INCREF(owner);
+    iter->adapter = owner;
+    iter->id = ++iterCount;
+    iter->context = NULL;
+
+    depth++;
+    iterActive = iter->id;
+    iterOwner = owner;
+    iterInterp = PyInterpreterState_Get();
+    iterCmd = cmd;
+    iterCmdString = cmdString;
+    iterQueue = new p4py::P4ResultQueue( iterBuffer );
+    ui.GetResults().SetQueue( iterQueue );
+
+    PrepareCmd( &ui );
+
+    debug.trace( P4PYDBG_COMMANDS, "run", cmd );
+
+    client.SetArgv( argc, argv );
+
+    // Always listen to the UI while streaming, so that an abandoned
+    // iterator can stop the command.
+    client.SetBreak( &ui );
+
+    iterThread = new std::thread( &PythonClientAPI::IterWorker, this );
+
+    return (PyObject *) iter;
+}
+
+//
+// Body of the thread started by RunIter(). The thread state is kept for
+// the whole command so that the ClientUser callbacks only have to swap
+// the GIL rather than creating a new thread state each time. On
+// free-threaded builds it also holds the lock of the P4 object, so the
+// callbacks are serialized with the consumer just as with the GIL.
+//
+
+void PythonClientAPI::IterWorker()
+{
+    AttachPythonThread guard( iterInterp );
+    LockPythonObject lock( iterOwner );
+
+    {
+	p4py::P4StatsTimer timer( ui.GetStats().runTime );
+	{
+	    ReleasePythonLock unlock;
+	    client.Run( iterCmd.Text(), &ui );
+	}
+
+	// Converting what is still batched is part of the command
+	p4py::P4StatsTimer convert( ui.GetStats().gilTime );
+	ui.FlushBatch();
+    }
+
+    // Exceptions raised by callbacks belong to the consumer
+    if( PyErr_Occurred() )
+	PyErr_Fetch( &iterErrType, &iterErrValue, &iterErrTb );
+
+    iterQueue->Done();
+}
+
+PyObject * PythonClientAPI::IterNext( int id )
+{
+    if( id != iterActive )
+	return NULL;
+
+    PyObject * item = iterQueue->Pop();
+    if( item )
+	return item;
+
+    // The command has completed and every record has been consumed
+
+    if( IterFinish( false ) )
+	CheckResults( iterCmdString.Text() );
+
+    return NULL;
+}
+
+int PythonClientAPI::IterNotify( int id, int fd )
+{
+    if( id != iterActive ) {
+	PyErr_SetString( PyExc_RuntimeError, "The command has already completed" );
+	return -1;
+    }
+
+    iterQueue->SetNotify( fd );
+    return 0;
+}
+
+PyObject * PythonClientAPI::IterPoll( int id )
+{
+    if( id != iterActive )
+	Py_RETURN_NONE;
+
+    PyObject * list = PyList_New( 0 );
+    if( !list )
+	return NULL;
+
+    PyObject * item;
+    int status;
+    while( ( status = iterQueue->TryPop( &item ) ) > 0 ) {
+	PyList_Append( list, item );
+	Py_DECREF( item );
+    }
+
+    if( status == 0 || PyList_GET_SIZE( list ) )
+	return list;
+
+    // The command has completed and every record has been consumed
+
+    Py_DECREF( list );
+
+    if( IterFinish( false ) )
+	CheckResults( iterCmdString.Text() );
+
+    if( PyErr_Occurred() )
+	return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyObject * PythonClientAPI::IterClose( int id )
+{
+    if( id == iterActive ) {
+	debug.debug( P4PYDBG_COMMANDS, "[P4] Abandoning streamed command" );
+
+	IterFinish( true );
+
+	if( client.Dropped() ) {
+	    Disconnect();
+
+	    PyObject * r = ConnectOrReconnect();
+	    if( !r )
+		return NULL;
+	    Py_DECREF( r );
+	}
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyObject * PythonClientAPI::IterAbandon()
+{
+    if( !iterActive )
+	Py_RETURN_NONE;
+
+    return IterClose( iterActive );
+}
+
+//
+// Waits for the streaming thread and restores the normal state. When
+// cancelling, the server is told to stop and any pending records and
+// errors are thrown away. Returns false if an exception has been set.
+//
+
+bool PythonClientAPI::IterFinish( bool cancel )
+{
+    if( cancel ) {
+	ui.Cancel();
+	iterQueue->Close();
+    }
+
+    {
+	ReleasePythonLock guard;
+	iterThread->join();
+    }
+
+    delete iterThread;
+    iterThread = NULL;
+
+    SaveStats();
+
+    ui.GetResults().SetQueue( NULL );
+    delete iterQueue;
+    iterQueue = NULL;
+
+    iterActive = 0;
+    depth--;
+
+    PostCmd();
+    client.SetBreak( keepAlive );
+
+    if( !iterErrType )
+	return true;
+
+    if( cancel ) {
+	Py_XDECREF( iterErrType );
+	Py_XDECREF( iterErrValue );
+	Py_XDECREF( iterErrTb );
+	iterErrType = iterErrValue = iterErrTb = NULL;
+	return true;
+    }
+
+    PyErr_Restore( iterErrType, iterErrValue, iterErrTb );
+    iterErrType = iterErrValue = iterErrTb = NULL;
+    return false;
+}
+
+//
+// Sends the commands without waiting for the results of the previous
+// ones, so that a series of small commands costs a single round trip
+// rather than one each. At most window commands are outstanding at any
+// time; waiting for the oldest one makes room for the next. Every command
+// gets its own PythonClientUser so that the results are kept apart. The
+// handler, input and resolver of this connection are not used.
+//
+// Returns a list with the output of each command, or the P4Exception
+// that run() would have raised for it according to the exception level.
+//
+
+PyObject * PythonClientAPI::RunPipelined( PyObject * commands, int window )
+{
+    debug.debug( P4PYDBG_COMMANDS, "[P4] Pipelining commands" );
+
+    if ( depth )
+    {
+    	(void) PyErr_WarnEx( PyExc_UserWarning, 
+		"P4.run() - Can't execute nested Perforce commands.", 1 );
+	Py_RETURN_FALSE;
+    }
+
+    if ( ! IsConnected() && exceptionLevel ) {
+	Except( "P4.run_pipelined()", "not connected." );
 	return NULL;
     }
+    
+    if ( ! IsConnected()  )
+	Py_RETURN_FALSE;
+
+    PyObject * seq = PySequence_Fast( commands,
+	    "run_pipelined() expects a sequence of commands" );
+    if( !seq )
+	return NULL;
+
+    // Convert all the arguments before anything is sent, so that a bad
+    // command cannot leave others outstanding.
+
+    Py_ssize_t			count = PySequence_Fast_GET_SIZE( seq );
+    vector< vector<const char *> >	argvs( count );
+    vector<PyObject *>		refs;	// keeps the argument strings alive
+    bool			ok = true;
+
+    for( Py_ssize_t i = 0; ok && i < count; i++ ) {
+	PyObject * args = PySequence_Fast( PySequence_Fast_GET_ITEM( seq, i ),
+		"each command must be a sequence of its name and arguments" );
+	if( !args ) {
+	    ok = false;
+	    break;
+	}
+	refs.push_back( args );
+
+	Py_ssize_t n = PySequence_Fast_GET_SIZE( args );
+	if( !n ) {
+	    PyErr_SetString( PyExc_ValueError, "empty command in run_pipelined()" );
+	    ok = false;
+	}
+
+	for( Py_ssize_t j = 0; ok && j < n; j++ ) {
+	    PyObject * item = PySequence_Fast_GET_ITEM( args, j );
+	    if( ! PyUnicode_Check(item) && ! PyBytes_Check(item) ) {
+		item = PyObject_Str( item );
+		if( !item ) {
+		    ok = false;
+		    break;
+		}
+		refs.push_back( item );
+	    }
 
-    return results.GetOutput();
+	    const char * arg = GetPythonString( item );
+	    if( !arg ) {
+		ok = false;
+		break;
+	    }
+	    argvs[i].push_back( arg );
+	}
+    }
+
+    PyObject * results = ok ? PyList_New( count ) : NULL;
+
+    if( results ) {
+	vector<PythonClientUser *> uis;
+	size_t oldest = 0;
+
+	depth++;
+
+	for( Py_ssize_t i = 0; i < count; i++ ) {
+	    vector<const char *> & argv = argvs[i];
+	    PythonClientUser * u = NewPipelinedUser( argv[0] );
+	    uis.push_back( u );
+
+	    PrepareCmd( u );
+
+	    debug.trace( P4PYDBG_COMMANDS, "run", argv[0] );
+
+	    ReleasePythonLock guard;
+
+	    client.SetArgv( (int) argv.size() - 1,
+		    argv.size() > 1 ? (char * const *) &argv[1] : NULL );
+	    client.RunTag( argv[0], u );
+
+	    if( uis.size() - oldest >= (size_t) window )
+		client.WaitTag( uis[oldest++] );
+	}
+
+	{
+	    ReleasePythonLock guard;
+	    client.WaitTag();
+	}
+
+	depth--;
+	PostCmd();
+
+	bool fatal = false;
+	for( Py_ssize_t i = 0; i < count; i++ ) {
+	    StrBuf cmdString;
+	    vector<const char *> & argv = argvs[i];
+	    FmtCommand( cmdString, argv[0], (int) argv.size() - 1,
+		    argv.size() > 1 ? (char * const *) &argv[1] : NULL );
+
+	    uis[i]->FlushBatch();
+	    fatal |= uis[i]->GetResults().FatalError() != 0;
+	    PyList_SET_ITEM( results, i, PipelinedResult( uis[i], cmdString.Text() ) );
+	    delete uis[i];
+	}
+
+	if( fatal && exceptionLevel )
+	    Py_XDECREF( Disconnect() );
+    }
+
+    for( size_t i = 0; i < refs.size(); i++ )
+	Py_DECREF( refs[i] );
+    Py_DECREF( seq );
+
+    return results;
+}
+
+PythonClientUser * PythonClientAPI::NewPipelinedUser( const char *cmd )
+{
+    PythonClientUser * u = new PythonClientUser( &debug, &specMgr );
+
+    u->SetApiLevel( apiLevel );
+    u->SetTrack( IsTrackMode() );
+    u->SetLazyRecords( ui.GetLazyRecords() );
+    u->SetStatChunk( ui.GetStatChunk() );
+    u->SetAssemblePrint( ui.GetAssemblePrint() );
+    u->SetDiffPerFile( ui.GetDiffPerFile() );
+    u->GetResults().SetColumnar( ui.GetResults().IsColumnar() );
+    u->SetCommand( cmd );
+
+    return u;
+}
+
+//
+// The output of a pipelined command, or the exception instance for its
+// errors and warnings as CheckResults() would have raised it.
+//
+
+PyObject * PythonClientAPI::PipelinedResult( PythonClientUser *u, const char *cmdString )
+{
+    p4py::P4Result & results = u->GetResults();
+
+    const char * msg = 0;
+    if( results.ErrorCount() && exceptionLevel )
+	msg = "Errors during command execution";
+    else if( results.WarningCount() && exceptionLevel > 1 )
+	msg = "Warnings during command execution";
+
+    if( !msg )
+	return results.GetOutput();
+
+    StrBuf m;
+    m << msg << "( " << cmdString << " )";
+    Except( "P4#run", m.Text(), results );
+
+    PyObject *type, *value, *tb;
+    PyErr_Fetch( &type, &value, &tb );
+    PyErr_NormalizeException( &type, &value, &tb );
+    Py_XDECREF( type );
+    Py_XDECREF( tb );
+
+    return value;
 }
 
 
@@ -899,9 +1437,9 @@ int PythonClientAPI::SetHandler( PyObject * iterator )
     }
 
     if( iterator == Py_None)
-	client.SetBreak(NULL);
+	SetKeepAlive(NULL);
     else
-	client.SetBreak(&ui);
+	SetKeepAlive(&ui);
 
     return 0;
 }
@@ -1106,7 +1644,7 @@ PyObject * PythonClientAPI::IsIgnored( const char * path)
 PyObject * PythonClientAPI::GetServerLevel()
 {
     if( !IsConnected() ) {
-	PyErr_SetString(P4Error, "Not connected to a Perforce server");
+	PyErr_SetString(P4API_ErrorType(), "Not connected to a Perforce server");
 	return NULL;
     }
     
@@ -1123,7 +1661,7 @@ PyObject * PythonClientAPI::GetServerLevel()
 PyObject * PythonClientAPI::GetServerCaseInsensitive() 
 {
     if( !IsConnected() ) {
-	PyErr_SetString(P4Error, "Not connected to a Perforce server");
+	PyErr_SetString(P4API_ErrorType(), "Not connected to a Perforce server");
 	return NULL;
     }
     
@@ -1143,7 +1681,7 @@ PyObject * PythonClientAPI::GetServerCaseInsensitive()
 PyObject * PythonClientAPI::GetServerUnicode() 
 {
     if( !IsConnected() ) {
-	PyErr_SetString(P4Error, "Not connected to a Perforce server");
+	PyErr_SetString(P4API_ErrorType(), "Not connected to a Perforce server");
 	return NULL;
     }
     
@@ -1157,6 +1695,11 @@ PyObject * PythonClientAPI::GetServerUnicode()
 }
 
 void PythonClientAPI::Except( const char *func, const char *msg )
+{
+    Except( func, msg, ui.GetResults() );
+}
+
+void PythonClientAPI::Except( const char *func, const char *msg, p4py::P4Result &results )
 {
     StrBuf	m;
     StrBuf	errors;
@@ -1166,8 +1709,8 @@ void PythonClientAPI::Except( const char *func, const char *msg )
     m << "[" << func << "] " << msg;
 
     // Now append any errors and warnings to the text
-    ui.GetResults().FmtErrors( errors );
-    ui.GetResults().FmtWarnings( warnings );
+    results.FmtErrors( errors );
+    results.FmtWarnings( warnings );
     
     if( errors.Length() )
     {
@@ -1184,8 +1727,12 @@ void PythonClientAPI::Except( const char *func, const char *msg )
     if( terminate )
 	m << "\n\n";
 
+    // Show what led up to the failure
+    if( debug.tracing() )
+	debug.dumpTrace();
+
     if( apiLevel < 68 )
-	PyErr_SetString(P4Error, m.Text() );
+	PyErr_SetString(P4API_ErrorType(), m.Text() );
     else {
 	// return a list with four elements:
 	// the string value, the list of errors, list of warnings,
@@ -1193,11 +1740,11 @@ void PythonClientAPI::Except( const char *func, const char *msg )
 	// P4Exception will sort out what's what
 	PyObject * list = PyList_New(4);
 	PyList_SET_ITEM(list, 0, CreatePythonString(m.Text()));
-	PyList_SET_ITEM(list, 1, ui.GetResults().GetErrors());
-	PyList_SET_ITEM(list, 2, ui.GetResults().GetWarnings());
-	PyList_SET_ITEM(list, 3, ui.GetResults().GetMessages());
+	PyList_SET_ITEM(list, 1, results.GetErrors());
+	PyList_SET_ITEM(list, 2, results.GetWarnings());
+	PyList_SET_ITEM(list, 3, results.GetMessages());
 
-	PyErr_SetObject(P4Error, list);
+	PyErr_SetObject(P4API_ErrorType(), list);
     Py_DECREF(list);
     }
 }
@@ -1229,6 +1776,30 @@ void PythonClientAPI::Except( const char *func, const char *msg, const char *cmd
 //
 
 void PythonClientAPI::RunCmd(const char *cmd, ClientUser *ui, int argc, char * const *argv)
+{
+    PrepareCmd( ui );
+
+    debug.trace( P4PYDBG_COMMANDS, "run", cmd );
+
+    PythonClientUser * u = (PythonClientUser *) ui;
+    {
+        p4py::P4StatsTimer timer( u->GetStats().runTime );
+        {
+            ReleasePythonLock guard;
+
+            client.SetArgv( argc, argv );
+            client.Run( cmd, ui );
+        }
+
+        // Converting what is still batched is part of the command
+        p4py::P4StatsTimer convert( u->GetStats().gilTime );
+        u->FlushBatch();
+    }
+
+    PostCmd();
+}
+
+void PythonClientAPI::PrepareCmd( ClientUser *ui )
 {
     StrBuf theProgStr = SetProgString(prog);
 
@@ -1256,14 +1827,10 @@ void PythonClientAPI::RunCmd(const char *cmd, ClientUser *ui, int argc, char * c
     // if progress is set, set the progress var
     if( ((PythonClientUser*)ui)->GetProgress() != Py_None )
 	client.SetVar( P4Tag::v_progress, 1);
+}
 
-    {
-        ReleasePythonLock guard;
-        
-        client.SetArgv( argc, argv );
-        client.Run( cmd, ui );
-    }
-    
+void PythonClientAPI::PostCmd()
+{
     // Have to request server2 protocol *after* a command has been run. I
     // don't know why, but that's the way it is.
 
@@ -1289,7 +1856,18 @@ void PythonClientAPI::SetBreak(PythonKeepAlive* cb)
 {
     if( IsConnected() ) {
         debug.debug(P4PYDBG_COMMANDS, "[P4] Establish the callback" );
-        client.SetBreak(cb);
+        SetKeepAlive(cb);
     }
 
 }
+
+// Remember the break callback, so that it can be reinstated after a
+// streamed command, which always uses the UI as its callback.
+
+void PythonClientAPI::SetKeepAlive( KeepAlive *k )
+{
+    keepAlive = k;
+
+    if( !iterActive )
+	client.SetBreak( k );
+}
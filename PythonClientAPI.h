@@ -39,6 +39,7 @@
 #define PYTHON_CLIENT_API_H
 
 #include "PythonKeepAlive.h"
+#include <thread>
 
 class Enviro;
 class PythonClientAPI
@@ -105,6 +106,14 @@ public:
     int SetMaxLockTime( int v )		{ maxLockTime = v; return 0; }
     int SetMaxOpenFiles( int v )	{ maxOpenFiles = v; return 0; }
     int SetMaxMemory( int v )	    { maxMemory = v; return 0; }
+    int SetIterBuffer( int v )		{ iterBuffer = v > 0 ? v : 1; return 0; }
+    int SetValueCacheSize( int v )	{ specMgr.SetValueCacheSize( v ); return 0; }
+    int SetColumnar( int v )		{ ui.GetResults().SetColumnar( v != 0 ); return 0; }
+    int SetLazyRecords( int v )		{ ui.SetLazyRecords( v != 0 ); return 0; }
+    int SetStatChunk( int v )		{ ui.SetStatChunk( v ); return 0; }
+    int SetTyped( int v )		{ specMgr.SetTyped( v ); return 0; }
+    int SetAssemblePrint( int v )	{ ui.SetAssemblePrint( v != 0 ); return 0; }
+    int SetDiffPerFile( int v )		{ ui.SetDiffPerFile( v != 0 ); return 0; }
 
     int SetCaseFolding( int v )		{ StrPtr::SetCaseFolding((StrPtr::CaseUse) v); return 0;}
 
@@ -116,6 +125,7 @@ public:
     //     3:	Show garbage collection ??? 
     //
     int SetDebug( int d );
+    int SetTraceSize( int n )		{ debug.setTraceSize( n ); return 0; }
 
     // Returns 0 on success, otherwise -1 and might raise exception
     int SetCharset( const char *c );
@@ -134,6 +144,7 @@ public:
     int SetUser( const char *u )	{ client.SetUser( u ); return 0; }
     int SetVersion( const char *v )	{ version = v; return 0; }
     int SetEnviroFile( const char *v );
+    int SetSpecCache( const char *d );
 
     const char * GetCharset()		{ return client.GetCharset().Text(); }
     const char * GetClient()		{ return client.GetClient().Text();}
@@ -148,6 +159,7 @@ public:
     const char * GetPassword()		{ return client.GetPassword().Text(); }
     const char * GetPort()		{ return client.GetPort().Text(); }
     const char * GetProg()		{ return prog.Text(); }
+    const char * GetSpecCache()		{ return specMgr.GetSpecCache(); }
     const char * GetTicketFile()	{ return ticketFile.Text(); }
     const char * GetUser()		{ return client.GetUser().Text(); }
     const char * GetVersion()		{ return version.Text(); }
@@ -158,7 +170,16 @@ public:
     int GetMaxLockTime()		{ return maxLockTime; }
     int GetMaxOpenFiles()		{ return maxOpenFiles; }
     int GetMaxMemory()		{ return maxMemory; }
+    int GetIterBuffer()			{ return iterBuffer; }
+    int GetValueCacheSize()		{ return specMgr.GetValueCacheSize(); }
+    int GetColumnar()			{ return ui.GetResults().IsColumnar(); }
+    int GetLazyRecords()		{ return ui.GetLazyRecords(); }
+    int GetStatChunk()			{ return ui.GetStatChunk(); }
+    int GetTyped()			{ return specMgr.GetTyped(); }
+    int GetAssemblePrint()		{ return ui.GetAssemblePrint(); }
+    int GetDiffPerFile()		{ return ui.GetDiffPerFile(); }
     int GetDebug()			{ return debug.getDebug(); }
+    int GetTraceSize()			{ return debug.getTraceSize(); }
     int GetApiLevel()			{ return apiLevel; }
     int GetCaseFolding()		{ return (int) StrPtr::CaseUsage(); }
     
@@ -177,6 +198,26 @@ public:
 
     // Executing commands. 
     PyObject * Run( const char *cmd, int argc, char * const *argv );
+
+    // Streaming execution. The command runs on a separate thread and each
+    // record is handed to the returned P4ResultIterator as soon as it has
+    // been converted. At most iterBuffer records are held at any time.
+    PyObject * RunIter( PyObject *owner, const char *cmd, int argc, char * const *argv );
+    PyObject * IterNext( int id );	// NULL at the end, maybe with exception
+    PyObject * IterClose( int id );	// abandon the command if still running
+    PyObject * IterAbandon();		// IterClose() on whatever is streaming
+
+    // Non-blocking consumption of a streamed command for event loops:
+    // IterNotify() makes the queue write a byte to fd when records are
+    // ready, IterPoll() returns the list of records ready so far, or None
+    // once the command has completed and all records have been consumed.
+    int IterNotify( int id, int fd );
+    PyObject * IterPoll( int id );
+
+    // Pipelined execution. Sends a sequence of commands (each a sequence
+    // of the command name and its arguments) with at most window of them
+    // waiting for results, and returns a list of the results of each.
+    PyObject * RunPipelined( PyObject * commands, int window );
     int SetInput( PyObject * input );
     PyObject * GetInput();
     
@@ -185,6 +226,8 @@ public:
 
     // OutputHandler interface
     int SetHandler( PyObject * handler );
+    int SetPrintTarget( PyObject * t )	{ return ui.SetPrintTarget( t ); }
+    PyObject * GetPrintTarget()		{ return ui.GetPrintTarget(); }
     PyObject * GetHandler();
 
     // Progress interface
@@ -196,6 +239,20 @@ public:
     PyObject * GetWarnings()		{ return ui.GetResults().GetWarnings();}
     PyObject * GetMessages()		{ return ui.GetResults().GetMessages();}
     PyObject * GetTrackOutput()		{ return ui.GetResults().GetTrack();}
+    PyObject * GetTrackStats()		{ return ui.GetResults().GetTrackStats();}
+    PyObject * GetLastCommandStats();
+    PyObject * GetTraceEvents()		{ return debug.getTrace(); }
+
+    // Statistics of the interned dict key table
+    PyObject * GetKeyCacheStats()	{ return specMgr.KeyCacheStats(); }
+    PyObject * GetSpecCacheStats()	{ return specMgr.SpecCacheStats(); }
+
+    // Value interning for low-cardinality fields, see SpecMgr
+    int SetValueCacheFields( PyObject * f )	{ return specMgr.SetValueCacheFields( f ); }
+    PyObject * GetValueCacheFields()	{ return specMgr.GetValueCacheFields(); }
+    PyObject * GetValueCacheStats()	{ return specMgr.ValueCacheStats(); }
+    int SetTypedFields( PyObject * f )	{ return specMgr.SetTypedFields( f ); }
+    PyObject * GetTypedFields()		{ return specMgr.GetTypedFields(); }
 
     // Config files
     PyObject * GetConfigFiles();
@@ -237,6 +294,7 @@ public:
     void Except( const char *func, const char *msg );
     void Except( const char *func, Error *e );
     void Except( const char *func, const char *msg, const char *cmd );
+    void Except( const char *func, const char *msg, p4py::P4Result &results );
 
     // SetBreak
     void SetBreak( PythonKeepAlive* cb );
@@ -257,7 +315,17 @@ public:
     
 private:
     void RunCmd(const char *cmd, ClientUser *ui, int argc, char * const *argv);
+    void PrepareCmd( ClientUser *ui );
+    void PostCmd();
+    bool CheckResults( const char *cmdString );
+    void SaveStats();
+    PythonClientUser * NewPipelinedUser( const char *cmd );
+    PyObject * PipelinedResult( PythonClientUser *u, const char *cmdString );
     PyObject * ConnectOrReconnect();
+    void SetKeepAlive( KeepAlive *k );
+
+    void IterWorker();
+    bool IterFinish( bool cancel );
 
     static intattribute_t * GetInt(const char * forAttr);
     static strattribute_t * GetStr(const char * forAttr);
@@ -335,6 +403,25 @@ private:
     int			maxLockTime;
     int			maxOpenFiles;
     int			maxMemory;
+    KeepAlive *		keepAlive;	// break callback outside of iteration
+
+    // State of the command run by RunIter(), if any
+    int			iterBuffer;
+    int			iterCount;
+    int			iterActive;
+    PyObject *		iterOwner;	// the P4 object, locked by the thread
+    PyInterpreterState * iterInterp;	// interpreter that started the thread
+    StrBuf		iterCmd;
+    StrBuf		iterCmdString;
+    std::thread *	iterThread;
+    p4py::P4ResultQueue * iterQueue;
+    PyObject *		iterErrType;
+    PyObject *		iterErrValue;
+    PyObject *		iterErrTb;
+
+    // Figures of the last command that has finished, see SaveStats()
+    p4py::P4CommandStats lastStats;
+    StrBuf		lastCommand;
 };
 
 #endif
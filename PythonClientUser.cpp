@@ -46,6 +46,10 @@ $Id: //depot/main/p4-python/PythonClientUser.cpp#37 $
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 #include "P4PythonDebug.h"
 #include "SpecMgr.h"
@@ -69,6 +73,7 @@ PythonClientUser::PythonClientUser( PythonDebug * dbg, p4py::SpecMgr *s )
       results(dbg, s)
 {
     track = false;
+    lazyRecords = false;
     alive = 1;
     apiLevel = atoi( P4Tag::l_client );
     
@@ -83,6 +88,18 @@ PythonClientUser::PythonClientUser( PythonDebug * dbg, p4py::SpecMgr *s )
 
     Py_INCREF(Py_None);
     progress = Py_None;
+
+    Py_INCREF(Py_None);
+    printTarget = Py_None;
+    printFile = NULL;
+    printState = PRINT_NONE;
+    assemblePrint = false;
+    diffPerFile = false;
+
+    batch = NULL;
+    batchSize = 0;
+    batchInterval = 0.0;
+    statChunk = 0;
 }
 
 PythonClientUser::~PythonClientUser()
@@ -91,11 +108,25 @@ PythonClientUser::~PythonClientUser()
     Py_DECREF(resolver);
     Py_DECREF(handler);
     Py_DECREF(progress);
+    Py_XDECREF(batch);
+
+    ClosePrintFile();
+    Py_DECREF(printTarget);
 }
 
 void PythonClientUser::Reset()
 {
     results.Reset();
+    stats.Reset();
+    ClosePrintFile();
+
+    printState = PRINT_NONE;
+    printContents.Reset();
+
+    if( batch )
+	PyList_SetSlice( batch, 0, PyList_GET_SIZE( batch ), NULL );
+    pending.Clear();
+
     // input data is untouched
 
     alive = 1; // yes, we want data from the server
@@ -103,7 +134,14 @@ void PythonClientUser::Reset()
 
 void PythonClientUser::Finished()
 {
+    ClosePrintFile();
+
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
+
+    FlushPrintContents();
+    printState = PRINT_NONE;
+    printContents.Reset();
     
     if ( input != Py_None )
 	debug->debug( P4PYDBG_CALLS, "[P4] Cleaning up saved input" );
@@ -122,16 +160,30 @@ static const int CANCEL = 2;
 // false if the output is handled and should be ignored
 
 bool PythonClientUser::CallOutputMethod( const char * method, PyObject * data)
+{
+    PyObject * result;
+    {
+	p4py::P4StatsTimer timer( stats.callbackTime );
+	result = PyObject_CallMethod( this->handler , (char*) method, (char*)"O", data );
+    }
+    bool report = CheckAnswer( result );
+    Py_XDECREF( result );
+
+    return report;
+}
+
+// Interprets the return value of a handler method, the same way for
+// single records and for batches
+
+bool PythonClientUser::CheckAnswer( PyObject * result )
 {
     long answer = REPORT;
 
-    PyObject * result = PyObject_CallMethod( this->handler , (char*) method, (char*)"O", data );
     if( result == NULL ) { // exception thrown
 	alive = 0;
     }
     else {
 	long a = PyInt_AsLong( result );
-	Py_DECREF( result );
 	if( a == -1 ) {
 	    alive = 0; // exception thrown or silly return value
 	}
@@ -146,8 +198,103 @@ bool PythonClientUser::CallOutputMethod( const char * method, PyObject * data)
     return ( answer == 0 );
 }
 
+//
+// Tagged output is collected into a list if the handler asked for batches.
+// The batch is passed to outputStatBatch() once it is full, once it is
+// older than the handler's batch_interval, or before any other output so
+// that the order of the results is preserved.
+//
+
+void PythonClientUser::ProcessStat( PyObject * data )
+{
+    if( !batch ) {
+	ProcessOutput( "outputStat", data );
+	return;
+    }
+
+    if( PyList_GET_SIZE( batch ) == 0 )
+	batchStart = chrono::steady_clock::now();
+
+    int rc = PyList_Append( batch, data );
+    Py_DECREF( data );
+    if( rc == -1 ) {
+	alive = 0;
+	return;
+    }
+
+    if( PyList_GET_SIZE( batch ) >= batchSize )
+	FlushBatch();
+    else if( batchInterval > 0.0 ) {
+	chrono::duration<double> age = chrono::steady_clock::now() - batchStart;
+	if( age.count() >= batchInterval )
+	    FlushBatch();
+    }
+}
+
+//
+// outputStatBatch() may answer for the whole batch with a single value,
+// or with a list holding one value per record.
+//
+
+void PythonClientUser::FlushBatch()
+{
+    // Once a callback has raised or cancelled the command, the records
+    // still waiting are dropped rather than handed to the handler
+    if( PyErr_Occurred() || !alive ) {
+	pending.Clear();
+	if( batch )
+	    PyList_SetSlice( batch, 0, PyList_GET_SIZE( batch ), NULL );
+	return;
+    }
+
+    ConvertPending();
+
+    if( !batch || PyList_GET_SIZE( batch ) == 0 )
+	return;
+
+    PyObject * items = PyList_GetSlice( batch, 0, PyList_GET_SIZE( batch ) );
+    PyList_SetSlice( batch, 0, PyList_GET_SIZE( batch ), NULL );
+    if( !items ) {
+	alive = 0;
+	return;
+    }
+
+    Py_ssize_t count = PyList_GET_SIZE( items );
+    PyObject * result;
+    {
+	p4py::P4StatsTimer timer( stats.callbackTime );
+	result = PyObject_CallMethod( this->handler, (char*) "outputStatBatch", (char*)"(O)", items );
+    }
+
+    if( result && PyList_Check( result ) && PyList_GET_SIZE( result ) == count ) {
+	for( Py_ssize_t i = 0; i < count; i++ ) {
+	    if( CheckAnswer( PyList_GET_ITEM( result, i ) ) ) {
+		PyObject * item = PyList_GET_ITEM( items, i );
+		Py_INCREF( item );
+		results.AddOutput( item );
+	    }
+
+	    // CANCEL stops at this record, as it does for single records
+	    if( !alive )
+		break;
+	}
+    }
+    else if( CheckAnswer( result ) ) {
+	for( Py_ssize_t i = 0; i < count; i++ ) {
+	    PyObject * item = PyList_GET_ITEM( items, i );
+	    Py_INCREF( item );
+	    results.AddOutput( item );
+	}
+    }
+
+    Py_XDECREF( result );
+    Py_DECREF( items );
+}
+
 void PythonClientUser::ProcessOutput( const char * method, PyObject * data )
 {
+    FlushBatch();
+
     if( this->handler != Py_None )
     {
 	if( CallOutputMethod( method, data ) )
@@ -163,6 +310,8 @@ void PythonClientUser::ProcessOutput( const char * method, PyObject * data )
 
 void PythonClientUser::ProcessMessage( Error *e )
 {
+    FlushBatch();
+
     if( this->handler != Py_None )
     {
 	int s = e->GetSeverity();
@@ -182,7 +331,12 @@ void PythonClientUser::ProcessMessage( Error *e )
 	}
 	else
 	{
-	    P4Message * msg = (P4Message *) PyObject_New(P4Message, &P4MessageType);
+	    P4API_state * st = P4API_GetState();
+	    P4Message * msg = st ? PyObject_New(P4Message, st->messageType) : NULL;
+	    if( !msg ) {
+		alive = 0;
+		return;
+	    }
 	    msg->msg = new PythonMessage(e, specMgr);
 
 	    if( CallOutputMethod( "outputMessage", (PyObject *) msg ) )
@@ -193,18 +347,43 @@ void PythonClientUser::ProcessMessage( Error *e )
 	results.AddError( e );
 }
 
+//
+// The size of the variables of a tagged record or message, which is what
+// the server sent for it give or take the framing
+//
+
+static unsigned long long DictBytes( StrDict * dict )
+{
+    unsigned long long bytes = 0;
+    StrRef var, val;
+
+    for( int i = 0; dict && dict->GetVar( i, var, val ); i++ )
+	bytes += var.Length() + val.Length();
+
+    return bytes;
+}
+
 void PythonClientUser::Message( Error *e )
 {
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
+
+    stats.messages++;
+    stats.bytes += DictBytes( e->GetDict() );
 
     debug->debug( P4PYDBG_CALLS , "[P4] Message()" );
-    StrBuf t;
-    e->Fmt( t, EF_PLAIN );
 
-    stringstream s;
-    s << "... [" << e->FmtSeverity() << "] " << t.Text() << ends;
+    if( debug->enabled( P4PYDBG_DATA ) || debug->tracing() ) {
+	StrBuf t;
+	e->Fmt( t, EF_PLAIN );
+	debug->trace( P4PYDBG_CALLS, "message", t.Text() );
 
-    debug->debug( P4PYDBG_DATA , s.str().c_str());
+	if( debug->enabled( P4PYDBG_DATA ) ) {
+	    stringstream s;
+	    s << "... [" << e->FmtSeverity() << "] " << t.Text() << ends;
+	    debug->debug( P4PYDBG_DATA , s.str().c_str());
+	}
+    }
 
     ProcessMessage( e );
 }
@@ -234,38 +413,59 @@ ClientProgress * PythonClientUser::CreateProgress( int type )
 void PythonClientUser::HandleError( Error *e )
 {
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
+
+    stats.messages++;
+    stats.bytes += DictBytes( e->GetDict() );
     
     debug->debug( P4PYDBG_CALLS, "[P4] HandleError()" );
 
-    StrBuf t;
-    e->Fmt( t, EF_PLAIN );
+    if( debug->enabled( P4PYDBG_DATA ) || debug->tracing() ) {
+	StrBuf t;
+	e->Fmt( t, EF_PLAIN );
+	debug->trace( P4PYDBG_CALLS, "error", t.Text() );
 
-    StrBuf buf("... ");
-    buf << "... [" << e->FmtSeverity() << "] " << t.Text();
+	StrBuf buf("... ");
+	buf << "... [" << e->FmtSeverity() << "] " << t.Text();
 
-    debug->debug( P4PYDBG_DATA , buf.Text() );
+	debug->debug( P4PYDBG_DATA , buf.Text() );
+    }
 
     ProcessMessage( e );
 }
 
 void PythonClientUser::OutputText( const char *data, int length )
 {
+    // Track output is sent after the last file, so don't write it there
+    bool isTrack = track && length > 4 && data[0] == '-' && data[1] == '-'
+		   && data[2] == '-' && data[3] == ' ';
+
+    stats.textRecords++;
+    stats.bytes += length;
+
+    debug->trace( P4PYDBG_CALLS, "outputText", data, length );
+
+    if( !isTrack && ( WritePrintFile( data, length )
+		|| AppendPrintContents( data, length, false ) ) )
+	return;
+
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
     
     debug->debug( P4PYDBG_CALLS , "[P4] OutputText()" );
-    stringstream s;
-    s << "... [" << length << "]" << setw(length) << data << ends;
 
-    debug->debug( P4PYDBG_DATA, s.str().c_str() );
+    if( debug->enabled( P4PYDBG_DATA ) ) {
+	stringstream s;
+	s << "... [" << length << "]" << setw(length) << data << ends;
+	debug->debug( P4PYDBG_DATA, s.str().c_str() );
+    }
 
-    if( track && length > 4 && data[0] == '-' && data[1] == '-' && data[2] == '-' && data[3] == ' ') {
+    if( isTrack ) {
 	int p = 4;
 	for( int i = 4; i < length; ++i ) {
 	    if( data[i] == '\n' ) {
 		if( i > p ) {
-		    PyObject * str = specMgr->CreatePyStringAndSize(data + p, i - p);
-		    if( str )
-			results.AddTrack( str );
+		    results.AddTrack( data + p, i - p );
 		    p = i + 5;
 		}
 		else {
@@ -294,11 +494,19 @@ void PythonClientUser::OutputText( const char *data, int length )
 void PythonClientUser::OutputInfo( char level, const char *data )
 {
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
+
+    stats.infoRecords++;
+    stats.bytes += strlen( data );
     
     debug->debug( P4PYDBG_CALLS, "[P4] OutputInfo()" );
-    stringstream s;
-    s << "... [" << level << "] " << data << ends;
-    debug->debug( P4PYDBG_DATA, s.str().c_str() );
+    debug->trace( P4PYDBG_CALLS, "outputInfo", data );
+
+    if( debug->enabled( P4PYDBG_DATA ) ) {
+	stringstream s;
+	s << "... [" << level << "] " << data << ends;
+	debug->debug( P4PYDBG_DATA, s.str().c_str() );
+    }
 
     PyObject * str = specMgr->CreatePyString(data);
     if( str ) {
@@ -308,11 +516,21 @@ void PythonClientUser::OutputInfo( char level, const char *data )
 
 void PythonClientUser::OutputBinary( const char *data, int length )
 {
+    stats.binaryRecords++;
+    stats.bytes += length;
+
+    debug->trace( P4PYDBG_CALLS, "outputBinary", 0, length );
+
+    if( WritePrintFile( data, length )
+	    || AppendPrintContents( data, length, true ) )
+	return;
+
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
     
     debug->debug( P4PYDBG_CALLS, "[P4] OutputBinary()" );
 
-    if( debug->getDebug() > P4PYDBG_DATA ) {
+    if( debug->enabled( P4PYDBG_DATA + 1 ) ) {
 	ios::fmtflags oldFlags = cout.flags();
 	stringstream s;
 
@@ -338,9 +556,75 @@ void PythonClientUser::OutputBinary( const char *data, int length )
     ProcessOutput("outputBinary", b);
 }
 
+//
+// With stat_chunk set, plain tagged output is copied into a native arena
+// without taking the GIL at all, and converted to Python objects under a
+// single GIL acquisition once stat_chunk records have been collected.
+// Forms, and anything a handler, a print target or the columns have to
+// see record by record, take the usual path. Any other output converts
+// the pending records first (see FlushBatch()), so the order of the
+// results is preserved.
+//
+
+bool PythonClientUser::DeferStat( StrDict * values )
+{
+    if( handler != Py_None || printTarget != Py_None || assemblePrint
+	    || results.IsColumnar() || values->GetVar( "specdef" ) )
+	return false;
+
+    stats.statRecords++;
+    pending.Add( values );
+
+    if( pending.Count() >= statChunk ) {
+	EnsurePythonLock guard;
+	p4py::P4StatsTimer timer( stats.gilTime );
+
+	ConvertPending();
+    }
+
+    return true;
+}
+
+// Must be called with the GIL held
+
+void PythonClientUser::ConvertPending()
+{
+    int count = pending.Count();
+    if( !count )
+	return;
+
+    debug->debug( P4PYDBG_CALLS, "[P4] Converting deferred tagged output" );
+
+    // Pipelined commands share the SpecMgr
+    specMgr->SetCommand( cmd.Text() );
+
+    for( int i = 0; i < count; i++ ) {
+	StrDict * dict = pending.Get( i );
+	PyObject * r = lazyRecords ? specMgr->StrDictToRecord( dict )
+				   : specMgr->StrDictToDict( dict );
+	if( !r ) {
+	    alive = 0;
+	    break;
+	}
+	results.AddOutput( r );
+    }
+
+    pending.Clear();
+}
+
 void PythonClientUser::OutputStat( StrDict *values )
 {
+    stats.bytes += DictBytes( values );
+
+    if( statChunk && DeferStat( values ) )
+	return;
+
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
+
+    stats.statRecords++;
+
+    debug->trace( P4PYDBG_CALLS, "outputStat" );
     
     StrPtr *		spec 	= values->GetVar( "specdef" );
     StrPtr *		data 	= values->GetVar( "data" );
@@ -359,6 +643,10 @@ void PythonClientUser::OutputStat( StrDict *values )
     //
     int			isspec	= spec && ( sf || data );
 
+    // Pipelined commands share the SpecMgr, so make sure it converts
+    // for this command
+    specMgr->SetCommand( cmd.Text() );
+
     //
     // Save the spec definition for later 
     //
@@ -391,6 +679,27 @@ void PythonClientUser::OutputStat( StrDict *values )
 	dict = specData.Dict();
     }
 
+    FlushPrintContents();
+
+    // print_target is an attribute, so other commands must not write files
+    if( printTarget != Py_None && !isspec && cmd == "print" )
+	OpenPrintFile( dict );
+
+    if( assemblePrint && !isspec && !printFile && handler == Py_None )
+	printState = PRINT_EMPTY;
+
+    //
+    // In columnar mode plain records go straight into the columns, unless
+    // a handler or the streaming queue wants to see each record.
+    //
+    if( !isspec && results.IsColumnar() && handler == Py_None
+	    && !results.GetQueue() )
+    {
+	debug->debug( P4PYDBG_CALLS, "[P4] OutputStat() - Adding to columns" );
+	results.AddRow( dict );
+	return;
+    }
+
     //
     // If what we've got is a parsed form, then we'll convert it to a P4::Spec
     // object. Otherwise it's a plain dict.
@@ -402,13 +711,18 @@ void PythonClientUser::OutputStat( StrDict *values )
 	debug->debug( P4PYDBG_CALLS, "[P4] OutputStat() - Converting to P4::Spec object" );
 	r = specMgr->StrDictToSpec( dict, spec );
     }
+    else if( lazyRecords )
+    {
+	debug->debug( P4PYDBG_CALLS, "[P4] OutputStat() - Converting to P4.Record" );
+	r = specMgr->StrDictToRecord( dict );
+    }
     else
     {
 	debug->debug( P4PYDBG_CALLS, "[P4] OutputStat() - Converting to dict" );
 	r = specMgr->StrDictToDict( dict );
     }
 
-    ProcessOutput("outputStat", r );
+    ProcessStat( r );
 }
 
 
@@ -423,9 +737,12 @@ void PythonClientUser::Diff( FileSys *f1, FileSys *f2, int doPage,
 				char *diffFlags, Error *e )
 {
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
     
     debug->debug( P4PYDBG_CALLS, "[P4] Diff() - comparing files" );
 
+    FlushBatch();
+
     //
     // Duck binary files. Much the same as ClientUser::Diff, we just
     // put the output into Python space rather than stdout.
@@ -443,11 +760,12 @@ void PythonClientUser::Diff( FileSys *f1, FileSys *f2, int doPage,
 
     FileSys *f1_bin = FileSys::Create( FST_BINARY );
     FileSys *f2_bin = FileSys::Create( FST_BINARY );
-    FileSys *t = FileSys::CreateGlobalTemp( f1->GetType() );
 
     f1_bin->Set( f1->Name() );
     f2_bin->Set( f2->Name() );
 
+    StrBuf	output;
+
     {
 	//
 	// In its own block to make sure that the diff object is deleted
@@ -456,26 +774,90 @@ void PythonClientUser::Diff( FileSys *f1, FileSys *f2, int doPage,
 	::Diff d;
 
 	d.SetInput( f1_bin, f2_bin, diffFlags, e );
+
+#ifndef OS_NT
+	//
+	// The diff is written to a memory stream rather than a temporary
+	// file. Diff doesn't close a stream it was handed, so we close it
+	// ourselves; only then are buf and len final and ours to free.
+	//
+	char *	buf = 0;
+	size_t	len = 0;
+	FILE *	out = 0;
+
+	if ( ! e->Test() && ! ( out = open_memstream( &buf, &len ) ) )
+	    e->Sys( "open_memstream", "diff" );
+
+	if ( out )
+	{
+	    if ( ! e->Test() )
+	    {
+		d.SetOutput( out );
+		d.DiffWithFlags( diffFlags );
+		d.CloseOutput( e );
+	    }
+
+	    if ( fclose( out ) && ! e->Test() )
+		e->Sys( "fclose", "diff" );
+	    else if ( ! e->Test() )
+		output.Set( buf, (p4size_t) len );
+	}
+	free( buf );
+#else
+	FileSys *t = FileSys::CreateGlobalTemp( f1->GetType() );
+
 	if ( ! e->Test() ) d.SetOutput( t->Name(), e );
 	if ( ! e->Test() ) d.DiffWithFlags( diffFlags );
 	d.CloseOutput( e );
 
-	// OK, now we have the diff output, read it in and add it to 
-	// the output.
+	// OK, now we have the diff output, read it in.
 	if ( ! e->Test() ) t->Open( FOM_READ, e );
 	if ( ! e->Test() ) 
 	{
-	    StrBuf 	b;
-	    while( t->ReadLine( &b, e ) )
-		results.AddOutput( b.Text() );
+	    char	b[ 4096 ];
+	    int		l;
+	    while( ( l = t->Read( b, sizeof( b ), e ) ) > 0 && ! e->Test() )
+		output.Append( b, l );
 	}
+
+	delete t;
+#endif
     }
 
-    delete t;
     delete f1_bin;
     delete f2_bin;
 
-    if ( e->Test() ) HandleError( e );
+    if ( e->Test() ) 
+    {
+	HandleError( e );
+	return;
+    }
+
+    //
+    // Add the diff to the output, either line by line or, with
+    // diffPerFile set, as a single string for the pair of files.
+    //
+    if ( diffPerFile )
+    {
+	if ( output.Length() )
+	    results.AddOutput( output.Text() );
+	return;
+    }
+
+    const char * p = output.Text();
+    const char * end = p + output.Length();
+
+    while( p < end )
+    {
+	const char * nl = (const char *) memchr( p, '\n', end - p );
+	const char * next = nl ? nl + 1 : end;
+
+	StrBuf line;
+	line.Set( p, (p4size_t) ( ( nl ? nl : end ) - p ) );
+	results.AddOutput( line.Text() );
+
+	p = next;
+    }
 }
 
 
@@ -535,9 +917,12 @@ void PythonClientUser::InputData( StrBuf *strbuf, Error *e )
 void PythonClientUser::Prompt( const StrPtr &msg, StrBuf &rsp, int noEcho, Error *e )
 {
     EnsurePythonLock guard;
-    stringstream s;
-    s << "[P4] Prompt(): " << msg.Text();
-    debug->debug ( P4PYDBG_CALLS, s.str().c_str() );
+
+    if( debug->enabled( P4PYDBG_CALLS ) ) {
+	stringstream s;
+	s << "[P4] Prompt(): " << msg.Text();
+	debug->debug ( P4PYDBG_CALLS, s.str().c_str() );
+    }
 
     InputData( &rsp, e );
 }
@@ -551,6 +936,7 @@ int PythonClientUser::Resolve( ClientMerge *m, Error *e )
     debug->debug( P4PYDBG_CALLS, "[P4] Resolve()" );
     
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
     
     //
     // If no resolver is defined, default to using the merger's resolve
@@ -586,7 +972,11 @@ int PythonClientUser::Resolve( ClientMerge *m, Error *e )
 
     PyObject * mergeData = MkMergeInfo( m, t );
 
-    PyObject * result = PyObject_CallMethod( this->resolver , (char*)"resolve", (char*)"(O)", mergeData );
+    PyObject * result;
+    {
+	p4py::P4StatsTimer timer( stats.callbackTime );
+	result = PyObject_CallMethod( this->resolver , (char*)"resolve", (char*)"(O)", mergeData );
+    }
     if( result == NULL ) { // exception thrown, bug out of here
 	return CMS_QUIT;
     }
@@ -626,6 +1016,7 @@ int PythonClientUser::Resolve( ClientResolveA *m, int preview, Error *e )
     debug->debug ( P4PYDBG_CALLS, "[P4] Resolve(Action)" );
 
     EnsurePythonLock guard;
+    p4py::P4StatsTimer timer( stats.gilTime );
 
     //
     // If no resolver is defined, default to using the merger's resolve
@@ -664,7 +1055,11 @@ int PythonClientUser::Resolve( ClientResolveA *m, int preview, Error *e )
 
     PyObject * mergeData = MkActionMergeInfo( m, t );
 
-    PyObject * result = PyObject_CallMethod( this->resolver , (char*)"actionResolve", (char*)"(O)", mergeData );
+    PyObject * result;
+    {
+	p4py::P4StatsTimer timer( stats.callbackTime );
+	result = PyObject_CallMethod( this->resolver , (char*)"actionResolve", (char*)"(O)", mergeData );
+    }
     if( result == NULL ) { // exception thrown, bug out of here
 	return CMS_QUIT;
     }
@@ -730,9 +1125,15 @@ PyObject * PythonClientUser::SetHandler( PyObject * c )
 {
     debug->debug( P4PYDBG_CALLS, "[P4] SetIterator()" );
 
-    int result = PyObject_IsInstance( c, P4OutputHandler );
+    P4API_state * st = P4API_GetState();
+    if( !st )
+	return NULL;
+
+    int result = PyObject_IsInstance( c, st->outputHandler );
 
     if( c == Py_None || 1 == result ) {
+	FlushBatch();
+
 	PyObject * tmp = handler;
 	handler = c;
 
@@ -741,6 +1142,8 @@ PyObject * PythonClientUser::SetHandler( PyObject * c )
 	Py_INCREF(handler);
 	Py_DECREF(tmp);
 
+	SetBatching();
+
 	Py_RETURN_TRUE;
     }
     else if ( 0 == result ) {
@@ -750,11 +1153,284 @@ PyObject * PythonClientUser::SetHandler( PyObject * c )
     return NULL;
 }
 
+int PythonClientUser::SetPrintTarget( PyObject * t )
+{
+    debug->debug( P4PYDBG_CALLS, "[P4] SetPrintTarget()" );
+
+    if( t != Py_None && !IsString(t) && !PyDict_Check(t) ) {
+	PyErr_SetString(PyExc_TypeError,
+		"print_target must be a directory name, a dict or None");
+	return -1;
+    }
+
+    ClosePrintFile();
+
+    PyObject * tmp = printTarget;
+    printTarget = t;
+
+    Py_INCREF(printTarget);
+    Py_DECREF(tmp);
+
+    return 0;
+}
+
+//
+// True if a path contains a ".." segment.
+//
+
+static bool HasParentSegment( const char * path )
+{
+    for( const char * p = path; *p; ) {
+	size_t n = strcspn( p, "/\\" );
+	if( n == 2 && p[0] == '.' && p[1] == '.' )
+	    return true;
+
+	p += n;
+	if( *p )
+	    p++;
+    }
+    return false;
+}
+
+//
+// Maps the type of a printed file, such as "text+x" or the older "kxtext",
+// to the FileSys type that p4 sync would use, so text files get local
+// line endings. Anything else, symlinks included, is written as is.
+//
+
+static FileSysType PrintFileType( StrPtr * type )
+{
+    static const struct {
+	const char *	name;
+	FileSysType	type;
+    } kinds[] = {
+	{ "text",	FST_TEXT },
+	{ "unicode",	FST_UNICODE },
+	{ "utf16",	FST_UTF16 },
+	{ "utf8",	FST_UTF8 },
+	{ "binary",	FST_BINARY },
+	{ "tempobj",	FST_BINARY },
+    };
+
+    if( !type )
+	return FST_BINARY;
+
+    const char * t = type->Text();
+    const char * mods = strchr( t, '+' );
+    std::string base( t, mods ? mods - t : strlen( t ) );
+
+    for( size_t i = 0; i < sizeof( kinds ) / sizeof( kinds[0] ); i++ ) {
+	size_t pos = base.find( kinds[i].name );
+	if( pos == std::string::npos )
+	    continue;
+
+	// executable as "+x" or as the x in legacy names like xbinary
+	bool exec = ( mods && strchr( mods, 'x' ) )
+	    || base.find( 'x' ) < pos;
+
+	return exec ? (FileSysType)( kinds[i].type | FST_M_EXEC ) : kinds[i].type;
+    }
+
+    return FST_BINARY;
+}
+
+//
+// Called with the header of each file that p4 print sends. The contents
+// that follow go into the file named by the print target; a depot file
+// that a dict target does not name is returned as usual.
+//
+
+void PythonClientUser::OpenPrintFile( StrDict * values )
+{
+    ClosePrintFile();
+
+    StrPtr * depotFile = values->GetVar( "depotFile" );
+    if( !depotFile )
+	return;
+
+    StrBuf path;
+
+    if( PyDict_Check(printTarget) ) {
+	PyObject * key = specMgr->CreatePyString( depotFile->Text() );
+	if( !key )
+	    return;
+
+	PyObject * local = PyDict_GetItem( printTarget, key );
+	Py_DECREF(key);
+
+	if( !local || !IsString(local) )
+	    return;
+
+	path = GetPythonString(local);
+    }
+    else {
+	const char * name = depotFile->Text();
+	while( *name == '/' )
+	    name++;
+
+	// The depot path must not lead out of the target directory
+	if( HasParentSegment( name ) ) {
+	    Error e;
+	    e.Set( E_FAILED, "Not writing %depotFile% outside the print target." )
+		<< depotFile->Text();
+	    HandleError( &e );
+	    return;
+	}
+
+	path << GetPythonString(printTarget) << "/" << name;
+    }
+
+    debug->debug( P4PYDBG_CALLS, "[P4] OpenPrintFile()" );
+
+    Error e;
+    FileSys * f = FileSys::Create( PrintFileType( values->GetVar( "type" ) ) );
+    f->Set( path );
+    f->MkDir( &e );
+    if( !e.Test() )
+	f->Open( FOM_WRITE, &e );
+
+    if( e.Test() ) {
+	delete f;
+	HandleError( &e );
+	return;
+    }
+
+    printFile = f;
+}
+
+void PythonClientUser::ClosePrintFile()
+{
+    if( !printFile )
+	return;
+
+    Error e;
+    printFile->Close( &e );
+    delete printFile;
+    printFile = NULL;
+
+    if( e.Test() )
+	HandleError( &e );
+}
+
+//
+// Writes the contents of the file being printed, if any. Doesn't touch
+// Python, so the GIL stays released for the whole transfer.
+//
+
+bool PythonClientUser::WritePrintFile( const char * data, int length )
+{
+    if( !printFile )
+	return false;
+
+    Error e;
+    printFile->Write( data, length, &e );
+
+    if( e.Test() ) {
+	HandleError( &e );
+	ClosePrintFile();
+    }
+    return true;
+}
+
+//
+// With assemblePrint set, the chunks of a printed file are collected in
+// printContents and handed over as one str (or bytes) when the next file
+// starts or the command finishes. Appending doesn't touch Python.
+//
+
+bool PythonClientUser::AppendPrintContents( const char * data, int length,
+					    bool binary )
+{
+    if( printState == PRINT_NONE )
+	return false;
+
+    if( printState == ( binary ? PRINT_TEXT : PRINT_BINARY ) ) {
+	// Mixed content, keep the parts apart as run_print used to
+	EnsurePythonLock guard;
+	p4py::P4StatsTimer timer( stats.gilTime );
+	FlushPrintContents();
+    }
+
+    printContents.Append( data, length );
+    printState = binary ? PRINT_BINARY : PRINT_TEXT;
+    return true;
+}
+
+void PythonClientUser::FlushPrintContents()
+{
+    if( printState == PRINT_NONE )
+	return;
+
+    PyObject * contents;
+
+    if( printState == PRINT_BINARY )
+	contents = PyBytes_FromStringAndSize( printContents.Text(),
+					      printContents.Length() );
+    else
+	contents = specMgr->CreatePyStringAndSize( printContents.Text(),
+						   printContents.Length() );
+
+    printState = PRINT_EMPTY;
+    printContents.Clear();
+
+    if( contents )
+	ProcessOutput( "outputText", contents );
+}
+
+//
+// Batching is opt-in: the handler's batch_size and batch_interval
+// attributes are read once, when the handler is set.
+//
+
+void PythonClientUser::SetBatching()
+{
+    batchSize = 0;
+    batchInterval = 0.0;
+
+    // Missing or odd attributes simply mean no batching
+
+    if( handler != Py_None ) {
+	PyObject * v = PyObject_GetAttrString( handler, "batch_size" );
+	if( v ) {
+	    batchSize = PyInt_AsLong( v );
+	    Py_DECREF( v );
+	}
+	if( PyErr_Occurred() ) {
+	    PyErr_Clear();
+	    batchSize = 0;
+	}
+
+	v = PyObject_GetAttrString( handler, "batch_interval" );
+	if( v ) {
+	    batchInterval = PyFloat_AsDouble( v );
+	    Py_DECREF( v );
+	}
+	if( PyErr_Occurred() ) {
+	    PyErr_Clear();
+	    batchInterval = 0.0;
+	}
+    }
+
+    if( batchSize > 1 ) {
+	if( !batch )
+	    batch = PyList_New( 0 );
+    }
+    else
+	Py_CLEAR( batch );
+
+    debug->debug( P4PYDBG_CALLS, batch ? "[P4] Batching tagged output"
+				       : "[P4] Not batching tagged output" );
+}
+
 PyObject * PythonClientUser::SetProgress( PyObject * p )
 {
     debug->debug( P4PYDBG_CALLS, "[P4] SetProgress()" );
 
-    int result = PyObject_IsInstance( p, P4Progress );
+    P4API_state * st = P4API_GetState();
+    if( !st )
+	return NULL;
+
+    int result = PyObject_IsInstance( p, st->progress );
 
     if( p == Py_None || 1 == result ) {
 	PyObject * tmp = progress;
@@ -787,7 +1463,8 @@ PyObject * PythonClientUser::MkMergeInfo( ClientMerge *m, StrPtr &hint )
 
     EnsurePythonLock guard;
     
-    P4MergeData *mergeObj = PyObject_New(P4MergeData, &P4MergeDataType);
+    P4API_state * st = P4API_GetState();
+    P4MergeData *mergeObj = st ? PyObject_New(P4MergeData, st->mergeDataType) : NULL;
     if (mergeObj != NULL) { 
         mergeObj->mergeData = new PythonMergeData( this, m, hint);
     }
@@ -805,11 +1482,13 @@ PyObject * PythonClientUser::MkActionMergeInfo( ClientResolveA *m, StrPtr &hint
     EnsurePythonLock guard;
 
     // retrieve the last entry in the result array
+    FlushBatch();
     PyObject * output = results.GetOutputInternal();
     Py_ssize_t len = PyList_Size(output);
     PyObject * info = PyList_GetItem(output, len - 1);
 
-    P4ActionMergeData *mergeObj = PyObject_New(P4ActionMergeData, &P4ActionMergeDataType);
+    P4API_state * st = P4API_GetState();
+    P4ActionMergeData *mergeObj = st ? PyObject_New(P4ActionMergeData, st->actionMergeDataType) : NULL;
     if (mergeObj != NULL) {
         mergeObj->mergeData = new PythonActionMergeData( this, m, hint, info);
     }
@@ -38,6 +38,11 @@
 #ifndef PYTHON_CLIENT_USER_H
 #define PYTHON_CLIENT_USER_H
 
+#include <chrono>
+#include <atomic>
+#include "P4CommandStats.h"
+#include "P4StatArena.h"
+
 class ClientProgress;
 
 class PythonClientUser: public ClientUser, public KeepAlive
@@ -90,6 +95,35 @@ public:
         return handler;
     }
 
+    // Where p4 print writes file contents: a directory, a dict of
+    // depot paths to local paths, or None to return the contents
+    int SetPrintTarget(PyObject * t);
+    PyObject * GetPrintTarget()
+    {
+        Py_INCREF(printTarget);
+        return printTarget;
+    }
+
+    // Collect the contents of each printed file into a single object
+    void SetAssemblePrint(bool a)
+    {
+        assemblePrint = a;
+    }
+    bool GetAssemblePrint()
+    {
+        return assemblePrint;
+    }
+
+    // Return the output of Diff() as one string per file pair
+    void SetDiffPerFile(bool d)
+    {
+        diffPerFile = d;
+    }
+    bool GetDiffPerFile()
+    {
+        return diffPerFile;
+    }
+
     PyObject * SetProgress(PyObject * p);
     PyObject * GetProgress()
     {
@@ -101,18 +135,52 @@ public:
     {
         cmd = c;
     }
+    const char * GetCommand()
+    {
+        return cmd.Text();
+    }
     void SetApiLevel(int level);
     void SetTrack(bool t)
     {
         track = t;
     }
+    void SetLazyRecords(bool l)
+    {
+        lazyRecords = l;
+    }
+    bool GetLazyRecords()
+    {
+        return lazyRecords;
+    }
+
+    // Collect plain tagged output without the GIL and convert it to
+    // Python objects every n records, 0 disables it
+    void SetStatChunk(int n)
+    {
+        statChunk = n > 0 ? n : 0;
+    }
+    int GetStatChunk()
+    {
+        return statChunk;
+    }
 
     p4py::P4Result& GetResults()
     {
         return results;
     }
+    p4py::P4CommandStats& GetStats()
+    {
+        return stats;
+    }
     int ErrorCount();
     void Reset();
+    void Cancel()
+    {
+        alive = 0;
+    }
+
+    // Hands any tagged output collected for outputStatBatch() to the handler
+    void FlushBatch();
 
     // override from KeepAlive
     virtual int IsAlive()
@@ -126,6 +194,16 @@ private:
     void ProcessOutput(const char * method, PyObject * data);
     void ProcessMessage(Error * e);
     bool CallOutputMethod(const char * method, PyObject * data);
+    bool CheckAnswer(PyObject * result);
+    void ProcessStat(PyObject * data);
+    bool DeferStat(StrDict * values);
+    void ConvertPending();
+    void SetBatching();
+    void OpenPrintFile(StrDict * values);
+    void ClosePrintFile();
+    bool WritePrintFile(const char * data, int length);
+    bool AppendPrintContents(const char * data, int length, bool binary);
+    void FlushPrintContents();
 
 private:
     StrBuf              cmd;
@@ -136,9 +214,23 @@ private:
     PyObject *          resolver;
     PyObject *          handler;
     PyObject *          progress;
+    PyObject *          printTarget;
+    FileSys *           printFile;      // file the current print writes to
+    StrBuf              printContents;  // contents of the current file
+    enum { PRINT_NONE, PRINT_EMPTY, PRINT_TEXT, PRINT_BINARY } printState;
+    bool                assemblePrint;
+    bool                diffPerFile;
+    p4py::P4CommandStats stats;
+    PyObject *          batch;          // pending records for outputStatBatch
+    long                batchSize;
+    double              batchInterval;  // seconds, 0 means no limit
+    std::chrono::steady_clock::time_point batchStart;
+    p4py::P4StatArena   pending;        // tagged output not yet converted
+    int                 statChunk;
     int                 apiLevel;
-    int                 alive;
+    std::atomic<int>    alive;          // cleared by Cancel() from any thread
     bool                track;
+    bool                lazyRecords;    // tagged output as P4.Record
 };
 
 #endif
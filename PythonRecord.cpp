@@ -0,0 +1,213 @@
+/*
+ * PythonRecord. Lazily converted tagged output.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: //depot/main/p4-python/PythonRecord.cpp#1 $
+ *
+ */
+
+/*******************************************************************************
+ * Name		: PythonRecord.cpp
+ *
+ * Description	: Storage behind P4.Record. Keeps a copy of the values of a
+ *		  tagged record and converts each one on first access
+ *
+ ******************************************************************************/
+
+#include <Python.h>
+#include <bytesobject.h>
+#include "undefdups.h"
+#include "python2to3.h"
+
+#include <clientapi.h>
+
+#include "PythonRecord.h"
+
+PythonRecord::PythonRecord(const char * e)
+    :	encoding(e)
+{
+}
+
+PythonRecord::~PythonRecord()
+{
+    for( size_t i = 0; i < entries.size(); i++ ) {
+	Py_DECREF(entries[i].key);
+	Py_XDECREF(entries[i].value);
+    }
+}
+
+void PythonRecord::AddValue(PyObject * key, const StrPtr & value)
+{
+    Entry e;
+    e.key = key;
+    e.offset = data.Length();
+    e.value = NULL;
+
+    data.Append(value.Text());
+    data.Extend('\0');
+
+    entries.push_back(e);
+}
+
+void PythonRecord::AddObject(PyObject * key, PyObject * value)
+{
+    Entry e;
+    e.key = key;
+    e.offset = 0;
+    e.value = value;
+
+    Py_INCREF(value);
+    entries.push_back(e);
+}
+
+void PythonRecord::SetObject(int i, PyObject * value)
+{
+    Py_INCREF(value);
+    Py_XDECREF(entries[i].value);
+    entries[i].value = value;
+}
+
+int PythonRecord::Find(PyObject * key)
+{
+    for( size_t i = 0; i < entries.size(); i++ ) {
+	if( entries[i].key == key )
+	    return (int) i;
+    }
+    return -1;
+}
+
+//
+// Keys created by the API are interned, so most lookups are satisfied by
+// comparing pointers. Fall back to a real comparison for anything else.
+//
+
+int PythonRecord::Lookup(PyObject * key)
+{
+    int i = Find(key);
+    if( i >= 0 || !IsString(key) )
+	return i;
+
+    for( size_t j = 0; j < entries.size(); j++ ) {
+	int eq = PyObject_RichCompareBool(entries[j].key, key, Py_EQ);
+	if( eq > 0 )
+	    return (int) j;
+	if( eq < 0 ) {
+	    PyErr_Clear();
+	    break;
+	}
+    }
+    return -1;
+}
+
+PyObject * PythonRecord::Value(size_t i)
+{
+    Entry & e = entries[i];
+
+    if( !e.value )
+	e.value = CreatePythonString(data.Text() + e.offset, encoding.Text());
+
+    return e.value;
+}
+
+PyObject * PythonRecord::GetItem(PyObject * key)
+{
+    int i = Lookup(key);
+    if( i < 0 )
+	return NULL;
+
+    PyObject * value = Value(i);
+    Py_XINCREF(value);
+    return value;
+}
+
+PyObject * PythonRecord::Keys()
+{
+    PyObject * list = PyList_New(entries.size());
+    if( !list )
+	return NULL;
+
+    for( size_t i = 0; i < entries.size(); i++ ) {
+	Py_INCREF(entries[i].key);
+	PyList_SET_ITEM(list, i, entries[i].key);
+    }
+    return list;
+}
+
+PyObject * PythonRecord::Values()
+{
+    PyObject * list = PyList_New(entries.size());
+    if( !list )
+	return NULL;
+
+    for( size_t i = 0; i < entries.size(); i++ ) {
+	PyObject * value = Value(i);
+	if( !value ) {
+	    Py_DECREF(list);
+	    return NULL;
+	}
+	Py_INCREF(value);
+	PyList_SET_ITEM(list, i, value);
+    }
+    return list;
+}
+
+PyObject * PythonRecord::Items()
+{
+    PyObject * list = PyList_New(entries.size());
+    if( !list )
+	return NULL;
+
+    for( size_t i = 0; i < entries.size(); i++ ) {
+	PyObject * value = Value(i);
+	if( !value ) {
+	    Py_DECREF(list);
+	    return NULL;
+	}
+	PyObject * item = Py_BuildValue("(OO)", entries[i].key, value);
+	if( !item ) {
+	    Py_DECREF(list);
+	    return NULL;
+	}
+	PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+PyObject * PythonRecord::ToDict()
+{
+    PyObject * dict = PyDict_New();
+    if( !dict )
+	return NULL;
+
+    for( size_t i = 0; i < entries.size(); i++ ) {
+	PyObject * value = Value(i);
+	if( !value || PyDict_SetItem(dict, entries[i].key, value) < 0 ) {
+	    Py_DECREF(dict);
+	    return NULL;
+	}
+    }
+    return dict;
+}
@@ -0,0 +1,88 @@
+/*
+ * PythonRecord. Lazily converted tagged output.
+ *
+ * Copyright (c) 2024, Perforce Software, Inc.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1.  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ * 2.  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTR
+ * IBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $Id: //depot/main/p4-python/PythonRecord.h#1 $
+ *
+ */
+
+/*******************************************************************************
+ * Name		: PythonRecord.h
+ *
+ * Description	: Storage behind P4.Record. Keeps a copy of the values of a
+ *		  tagged record and converts each one on first access
+ *
+ ******************************************************************************/
+
+#ifndef PYTHONRECORD_H_
+#define PYTHONRECORD_H_
+
+#include <vector>
+
+class PythonRecord
+{
+public:
+    PythonRecord(const char * encoding);
+    ~PythonRecord();
+
+    // Building, used by SpecMgr::StrDictToRecord(). Both steal the key.
+    void AddValue(PyObject * key, const StrPtr & value);
+    void AddObject(PyObject * key, PyObject * value);
+    void SetObject(int i, PyObject * value);
+
+    // Index of the entry for key (compared by identity), or -1
+    int Find(PyObject * key);
+
+public:
+    Py_ssize_t Length() { return (Py_ssize_t) entries.size(); }
+
+    // All return new references. GetItem returns NULL without an
+    // exception set if the key is unknown.
+    PyObject * GetItem(PyObject * key);
+    PyObject * Keys();
+    PyObject * Values();
+    PyObject * Items();
+    PyObject * ToDict();
+
+    // Whether there is a value for key, without decoding it
+    bool Contains(PyObject * key)	{ return Lookup(key) >= 0; }
+
+private:
+    int Lookup(PyObject * key);
+    PyObject * Value(size_t i);		// borrowed reference
+
+    struct Entry {
+	PyObject *	key;
+	p4size_t	offset;		// start of the value in data
+	PyObject *	value;		// NULL until first accessed
+    };
+
+    std::vector<Entry>	entries;
+    StrBuf		data;		// NUL terminated values
+    StrBuf		encoding;
+};
+
+#endif /* PYTHONRECORD_H_ */
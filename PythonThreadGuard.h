@@ -71,4 +71,55 @@ class EnsurePythonLock
             PyGILState_Release(gstate);
         }
 };
+
+// Guard class for the threads started by P4Python itself. It creates a
+// thread state in the given interpreter, which must be the one that
+// started the thread; PyGILState_Ensure() would always pick the main
+// interpreter. The thread holds the GIL until the guard goes away, and
+// EnsurePythonLock works as usual inside it.
+
+class AttachPythonThread
+{
+    PyThreadState *tstate;
+
+    public:
+	AttachPythonThread( PyInterpreterState * interp ) {
+	    tstate = PyThreadState_New( interp );
+	    PyEval_RestoreThread( tstate );
+	}
+
+	~AttachPythonThread() {
+	    PyThreadState_Clear( tstate );
+	    PyThreadState_DeleteCurrent();
+	}
+};
+
+// Guard class that holds the per-object lock of a Python object.
+//
+// On free-threaded builds the GIL no longer serializes access to the C++
+// state behind our objects, so every entry point locks the object it
+// works on. Like the GIL, the lock is suspended whenever the thread
+// releases its thread state (ReleasePythonLock, or waiting for another
+// lock) and taken again afterwards, so the existing rules about nested
+// commands still apply. With the GIL this is a no-op.
+
+class LockPythonObject
+{
+#ifdef Py_GIL_DISABLED
+    PyCriticalSection cs;
+
+    public:
+	LockPythonObject( PyObject * o ) {
+	    PyCriticalSection_Begin( &cs, o );
+	}
+
+	~LockPythonObject() {
+	    PyCriticalSection_End( &cs );
+	}
+#else
+    public:
+	LockPythonObject( PyObject * ) {}
+#endif
+};
+
 #endif // PYTHON_THREAD_GUARD_H
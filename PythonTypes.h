@@ -43,8 +43,11 @@ class PythonActionMergeData;
 
 namespace p4py {
 class P4MapMaker;
+class P4ConnectionPool;
+class P4CommandBatch;
 }
 class PythonMessage;
+class PythonRecord;
 
 /* C container for P4Adapter */
 typedef struct {
@@ -76,12 +79,71 @@ typedef struct {
     PythonMessage *msg;
 } P4Message;
 
-extern PyTypeObject P4MergeDataType;
-extern PyTypeObject P4ActionMergeDataType;
-extern PyTypeObject P4MapType;
-extern PyObject * P4Error;
-extern PyObject * P4OutputHandler;
-extern PyObject * P4Progress;
-extern PyTypeObject P4MessageType;
+/* C container for the iterator returned by P4Adapter.run_iter */
+typedef struct {
+    PyObject_HEAD
+    PyObject *adapter;      /* The P4Adapter running the command */
+    int id;                 /* Identifies the command within the adapter */
+    PyObject *context;      /* Attributes to restore once it has finished */
+} P4ResultIterator;
+
+/* C container for Record */
+typedef struct {
+    PyObject_HEAD
+    PythonRecord *rec;
+} P4Record;
+
+/* C container for Pool */
+typedef struct {
+    PyObject_HEAD
+    p4py::P4ConnectionPool *pool;
+} P4Pool;
+
+/* C container for the iterator returned by P4.run_many */
+typedef struct {
+    PyObject_HEAD
+    p4py::P4CommandBatch *batch;
+} P4Batch;
+
+/* C container for Spec, a dict checking its keys against a field table */
+typedef struct {
+    PyDictObject dict;
+    PyObject *fields;       /* Field table shared by the specs of a specdef */
+} P4Spec;
+
+/* Per-interpreter state of the P4API module */
+struct P4API_state {
+    PyObject *		error;			/* P4API.Error */
+    PyObject *		p4Error;		/* P4.P4Exception */
+    PyObject *		outputHandler;		/* P4.OutputHandler */
+    PyObject *		progress;		/* P4.Progress */
+    PyObject *		specClass;		/* P4.Spec */
+    PyTypeObject *	adapterType;
+    PyTypeObject *	mergeDataType;
+    PyTypeObject *	actionMergeDataType;
+    PyTypeObject *	mapType;
+    PyTypeObject *	messageType;
+    PyTypeObject *	resultIteratorType;
+    PyTypeObject *	recordType;
+    PyTypeObject *	poolType;
+    PyTypeObject *	batchType;
+    PyTypeObject *	specType;
+};
+
+/* The state of the module imported into the current interpreter, or NULL
+   with an exception set if P4API has not been imported into it */
+P4API_state * P4API_GetState();
+
+/* P4.P4Exception, or RuntimeError if there is no module state */
+PyObject * P4API_ErrorType();
+
+/* Builds the field table for a map of lower case names to field names */
+PyObject * P4Spec_NewFields( PyObject * fieldmap );
+
+/* Returns the map of a field table, a borrowed reference */
+PyObject * P4Spec_FieldMap( PyObject * fields );
+
+/* Creates an empty P4.Spec using the field table */
+PyObject * P4Spec_New( PyObject * fields );
 
 #endif
@@ -47,10 +47,22 @@
 #include "P4PythonDebug.h"
 #include "PythonSpecData.h"
 #include "SpecMgr.h"
+#include "PythonRecord.h"
+#include "PythonTypes.h"
 
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <cstdio>
+#include <cctype>
+#include <atomic>
+
+#ifdef _WIN32
+# include <process.h>
+# define getpid _getpid
+#else
+# include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -342,41 +354,645 @@ struct specdata {
 };
 
 
+// Upper limit for the key table. Field names are a small set, but
+// attributes (attr-*) can add arbitrary names, so don't grow forever.
+
+static const size_t MAX_KEYS = 4096;
+
+// Upper limit for the cache of parsed spec definitions. A session rarely
+// sees more than the spec types of the server.
+
+static const size_t MAX_SPECS = 32;
+
 SpecMgr::SpecMgr(PythonDebug * dbg)
     : debug(dbg)
 {
     specs = 0;
     encoding = "";
+    keyCount = 0;
+    keyHits = 0;
+    keyMisses = 0;
+    keys.resize(64);
+    valueCapacity = 0;
+    valueHits = 0;
+    valueMisses = 0;
+    specHits = 0;
+    specMisses = 0;
+    typed = false;
+    typedFields = 0;
     Reset();
+
+    static const char * defaultValueFields[] = {
+	"action", "type", "headType", "headAction", "change", "user", "client",
+	0
+    };
+
+    for( const char ** f = defaultValueFields; *f; f++ )
+	valueFields.push_back( DictKey(*f, strlen(*f)) );
+
+    DefaultTypedFields();
 }
 
 SpecMgr::~SpecMgr() {
     delete specs;
+
+    ClearValues();
+    ClearSpecs();
+    ClearTypedFields();
+
+    for( size_t i = 0; i < valueFields.size(); i++ )
+	Py_XDECREF(valueFields[i]);
+
+    for( size_t i = 0; i < keys.size(); i++ )
+	Py_XDECREF(keys[i].key);
+}
+
+static unsigned int HashKey( const char * name, p4size_t len ) {
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for( p4size_t i = 0; i < len; i++ ) {
+	h ^= (unsigned char) name[i];
+	h *= 16777619u;
+    }
+    return h;
+}
+
+PyObject * SpecMgr::DictKey( const char * name, p4size_t len ) {
+    unsigned int h = HashKey(name, len);
+    size_t mask = keys.size() - 1;
+    size_t i = h & mask;
+
+    for( ; keys[i].key; i = (i + 1) & mask ) {
+	KeyEntry & e = keys[i];
+	if( e.hash == h && e.name.Length() == len
+		&& !memcmp(e.name.Text(), name, len) ) {
+	    keyHits++;
+	    Py_INCREF(e.key);
+	    return e.key;
+	}
+    }
+
+    keyMisses++;
+
+#if PY_MAJOR_VERSION >= 3
+    PyObject * key = PyUnicode_FromStringAndSize(name, len);
+    if( key )
+	PyUnicode_InternInPlace(&key);
+#else
+    PyObject * key = PyString_FromStringAndSize(name, len);
+    if( key )
+	PyString_InternInPlace(&key);
+#endif
+
+    if( !key || keyCount >= MAX_KEYS )
+	return key;
+
+    // Keep the load factor below one half
+
+    if( 2 * (keyCount + 1) > keys.size() ) {
+	std::vector<KeyEntry> old;
+	old.swap(keys);
+	keys.resize(old.size() * 2);
+	mask = keys.size() - 1;
+
+	for( size_t j = 0; j < old.size(); j++ ) {
+	    if( !old[j].key )
+		continue;
+	    size_t k = old[j].hash & mask;
+	    while( keys[k].key )
+		k = (k + 1) & mask;
+	    keys[k] = old[j];
+	}
+
+	for( i = h & mask; keys[i].key; i = (i + 1) & mask )
+	    ;
+    }
+
+    keys[i].hash = h;
+    keys[i].name.Set(name, len);
+    keys[i].key = key;
+    Py_INCREF(key);
+    keyCount++;
+
+    return key;
+}
+
+PyObject * SpecMgr::KeyCacheStats() {
+    return Py_BuildValue("{s:k,s:k,s:n}",
+	    "hits", keyHits,
+	    "misses", keyMisses,
+	    "size", (Py_ssize_t) keyCount);
+}
+
+void SpecMgr::SetValueCacheSize( int size ) {
+    valueCapacity = size > 0 ? size : 0;
+
+    while( values.size() > valueCapacity ) {
+	valueIndex.erase(values.back().first);
+	Py_DECREF(values.back().second);
+	values.pop_back();
+    }
+}
+
+void SpecMgr::ClearValues() {
+    valueIndex.clear();
+
+    for( ValueList::iterator i = values.begin(); i != values.end(); ++i )
+	Py_DECREF(i->second);
+    values.clear();
+}
+
+//
+// Converts a sequence of field names into interned keys. On error the
+// exception is set and interned is left empty.
+//
+
+int SpecMgr::InternFields( PyObject * fields, const char * msg,
+			   std::vector<PyObject *> &interned ) {
+    if( IsString(fields) ) {
+	PyErr_SetString(PyExc_TypeError, msg);
+	return -1;
+    }
+
+    PyObject * seq = PySequence_Fast(fields, msg);
+    if( !seq )
+	return -1;
+
+    for( Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++ ) {
+	PyObject * item = PySequence_Fast_GET_ITEM(seq, i);
+	PyObject * key = NULL;
+
+	if( IsString(item) ) {
+	    const char * name = GetPythonString(item);
+	    key = DictKey(name, strlen(name));
+	}
+	else {
+	    PyErr_SetString(PyExc_TypeError, msg);
+	}
+
+	if( !key ) {
+	    for( size_t j = 0; j < interned.size(); j++ )
+		Py_DECREF(interned[j]);
+	    interned.clear();
+	    Py_DECREF(seq);
+	    return -1;
+	}
+	interned.push_back(key);
+    }
+
+    Py_DECREF(seq);
+    return 0;
+}
+
+int SpecMgr::SetValueCacheFields( PyObject * fields ) {
+    std::vector<PyObject *> interned;
+
+    if( fields != Py_None && InternFields(fields,
+	    "value_cache_fields must be a sequence of field names", interned) )
+	return -1;
+
+    valueFields.swap(interned);
+    for( size_t j = 0; j < interned.size(); j++ )
+	Py_XDECREF(interned[j]);
+
+    return 0;
+}
+
+PyObject * SpecMgr::GetValueCacheFields() {
+    PyObject * list = PyList_New(valueFields.size());
+    if( !list )
+	return NULL;
+
+    for( size_t i = 0; i < valueFields.size(); i++ ) {
+	Py_INCREF(valueFields[i]);
+	PyList_SET_ITEM(list, i, valueFields[i]);
+    }
+    return list;
+}
+
+PyObject * SpecMgr::ValueCacheStats() {
+    return Py_BuildValue("{s:k,s:k,s:n}",
+	    "hits", valueHits,
+	    "misses", valueMisses,
+	    "size", (Py_ssize_t) values.size());
+}
+
+//
+// Create the value for a field. Values of fields in the allow-list come
+// from the LRU cache if the cache is enabled. The key must come from
+// DictKey() as the allow-list is checked by identity.
+//
+
+PyObject * SpecMgr::CreateValue( PyObject * key, const StrPtr *val ) {
+    PyObject * number = TypedValue(key, val);
+    if( number || PyErr_Occurred() )
+	return number;
+
+    if( !valueCapacity )
+	return CreatePyString(val->Text());
+
+    size_t i = 0;
+    while( i < valueFields.size() && valueFields[i] != key )
+	i++;
+
+    if( i == valueFields.size() )
+	return CreatePyString(val->Text());
+
+    std::string bytes(val->Text(), val->Length());
+    std::unordered_map<std::string, ValueList::iterator>::iterator found
+	= valueIndex.find(bytes);
+
+    if( found != valueIndex.end() ) {
+	valueHits++;
+	values.splice(values.begin(), values, found->second);
+	Py_INCREF(found->second->second);
+	return found->second->second;
+    }
+
+    valueMisses++;
+
+    PyObject * value = CreatePyString(val->Text());
+    if( !value )
+	return NULL;
+
+    if( values.size() >= valueCapacity ) {
+	valueIndex.erase(values.back().first);
+	Py_DECREF(values.back().second);
+	values.pop_back();
+    }
+
+    Py_INCREF(value);
+    values.push_front(ValueEntry(bytes, value));
+    valueIndex[bytes] = values.begin();
+
+    return value;
+}
+
+//
+// Typed fields. The built-in schemas cover the numeric fields of the
+// commands most often used in scripts; the schemas can be replaced
+// through the typed_fields attribute.
+//
+
+void SpecMgr::ClearTypedFields() {
+    for( SchemaMap::iterator i = typedSchemas.begin(); i != typedSchemas.end(); ++i )
+	for( size_t j = 0; j < i->second.size(); j++ )
+	    Py_DECREF(i->second[j]);
+
+    typedSchemas.clear();
+    typedFields = 0;
+    command.clear();	// look the schema up again on the next SetCommand()
+}
+
+void SpecMgr::DefaultTypedFields() {
+    static const char * defaultSchemas[][10] = {
+	{ "fstat", "headRev", "haveRev", "headChange", "headTime",
+	  "headModTime", "workRev", "fileSize", 0 },
+	{ "changes", "change", "time", 0 },
+	{ "describe", "change", "time", "rev", "fileSize", 0 },
+	{ "sizes", "rev", "change", "fileSize", "fileCount", 0 },
+	{ "filelog", "rev", "change", "time", "fileSize", 0 },
+	{ 0 }
+    };
+
+    ClearTypedFields();
+
+    for( int i = 0; defaultSchemas[i][0]; i++ ) {
+	std::vector<PyObject *> & fields = typedSchemas[defaultSchemas[i][0]];
+	for( const char ** f = defaultSchemas[i] + 1; *f; f++ ) {
+	    PyObject * key = DictKey(*f, strlen(*f));
+	    if( key )
+		fields.push_back(key);
+	}
+    }
+
+    SetCommand(command.c_str());
+}
+
+void SpecMgr::SetCommand( const char * cmd ) {
+    if( command == cmd )
+	return;
+
+    command = cmd;
+
+    SchemaMap::iterator i = typedSchemas.find(command);
+    typedFields = i != typedSchemas.end() ? &i->second : 0;
+}
+
+int SpecMgr::SetTypedFields( PyObject * schemas ) {
+    if( schemas == Py_None ) {
+	DefaultTypedFields();
+	return 0;
+    }
+
+    if( !PyDict_Check(schemas) ) {
+	PyErr_SetString(PyExc_TypeError,
+		"typed_fields must be a dict of command names to field names");
+	return -1;
+    }
+
+    SchemaMap table;
+    Py_ssize_t pos = 0;
+    PyObject *cmd, *fields;
+    int result = 0;
+
+    while( !result && PyDict_Next(schemas, &pos, &cmd, &fields) ) {
+	if( !IsString(cmd) ) {
+	    PyErr_SetString(PyExc_TypeError,
+		    "typed_fields must be a dict of command names to field names");
+	    result = -1;
+	    break;
+	}
+
+	result = InternFields(fields,
+		"typed_fields must map commands to sequences of field names",
+		table[GetPythonString(cmd)]);
+    }
+
+    ClearTypedFields();
+    typedSchemas.swap(table);
+
+    if( result )
+	ClearTypedFields();
+
+    SetCommand(command.c_str());
+    return result;
+}
+
+PyObject * SpecMgr::GetTypedFields() {
+    PyObject * dict = PyDict_New();
+    if( !dict )
+	return NULL;
+
+    for( SchemaMap::iterator i = typedSchemas.begin(); i != typedSchemas.end(); ++i ) {
+	PyObject * list = PyList_New(i->second.size());
+	if( !list ) {
+	    Py_DECREF(dict);
+	    return NULL;
+	}
+
+	for( size_t j = 0; j < i->second.size(); j++ ) {
+	    Py_INCREF(i->second[j]);
+	    PyList_SET_ITEM(list, j, i->second[j]);
+	}
+
+	int rc = PyDict_SetItemString(dict, i->first.c_str(), list);
+	Py_DECREF(list);
+	if( rc ) {
+	    Py_DECREF(dict);
+	    return NULL;
+	}
+    }
+    return dict;
+}
+
+//
+// Returns the value of a typed field as an int, straight from the bytes
+// of the value. Returns NULL without an exception if the field is not
+// typed or the value is not a number (e.g. "default" for a change), so
+// that the caller falls back to a string.
+//
+
+PyObject * SpecMgr::TypedValue( PyObject * key, const StrPtr *val ) {
+    if( !typed || !typedFields )
+	return NULL;
+
+    size_t i = 0;
+    while( i < typedFields->size() && (*typedFields)[i] != key )
+	i++;
+
+    if( i == typedFields->size() )
+	return NULL;
+
+    const char * p = val->Text();
+    const char * end = p + val->Length();
+    bool negative = p < end && *p == '-';
+
+    if( negative )
+	p++;
+
+    if( p == end )
+	return NULL;
+
+    for( const char * c = p; c < end; c++ )
+	if( *c < '0' || *c > '9' )
+	    return NULL;
+
+    // Anything that might not fit a long long goes the slow way
+    if( end - p > 18 )
+	return PyLong_FromString((char *) val->Text(), NULL, 10);
+
+    long long n = 0;
+    for( ; p < end; p++ )
+	n = n * 10 + (*p - '0');
+
+    return PyLong_FromLongLong(negative ? -n : n);
+}
+
+int SpecMgr::SetItem( PyObject * dict, const StrPtr &key, PyObject * value ) {
+    PyObject * k = DictKey(key);
+    if( !k )
+	return -1;
+
+    int result = PyDict_SetItem(dict, k, value);
+    Py_DECREF(k);
+    return result;
 }
 
 void SpecMgr::AddSpecDef( const char *type, StrPtr &specDef ) {
-    if( specs->GetVar(type) )
-	specs->RemoveVar(type);
-    specs->SetVar(type, specDef);
+    // Every form of a command comes with the same specdef
+    if( SetSpecDef(type, specDef) )
+	SaveSpecDef(type, specDef);
+
+    specsAdded.insert(type);
 }
 
 void SpecMgr::AddSpecDef( const char *type, const char *specDef ) {
-    if( specs->GetVar(type) )
+    StrRef def(specDef);
+    AddSpecDef(type, def);
+}
+
+// Returns true if the specdef of the type has changed
+
+bool SpecMgr::SetSpecDef( const char *type, const StrPtr &specDef ) {
+    StrPtr * old = specs->GetVar(type);
+
+    if( old && *old == specDef )
+	return false;
+
+    if( old )
 	specs->RemoveVar(type);
     specs->SetVar(type, specDef);
+    return true;
 }
 
 void SpecMgr::Reset() {
     delete specs;
     specs = new StrBufDict;
+    specsAdded.clear();
+    cacheChecked.clear();
 
     for( struct specdata *sp = &speclist[0]; sp->type; sp++ )
-	AddSpecDef(sp->type, sp->spec);
+	SetSpecDef(sp->type, StrRef(sp->spec));
 
 }
 
 int SpecMgr::HaveSpecDef( const char *type ) {
-    return specs->GetVar(type) != 0;
+    return GetSpecDef(type) != 0;
+}
+
+//
+// The specdef of a type. Until the server has sent one, the spec cache
+// may have a better one than the built-in default, e.g. for a jobspec
+// with custom fields, so look there first.
+//
+
+StrPtr * SpecMgr::GetSpecDef( const char *type ) {
+    if( cacheDir.Length() && !specsAdded.count(type)
+	    && cacheChecked.insert(type).second )
+	LoadSpecDef(type);
+
+    return specs->GetVar(type);
+}
+
+//
+// Spec cache. Specdefs sent by the server are kept in a directory so that
+// short-lived processes such as triggers can parse and format specs
+// without asking the server first. There is one file per server address
+// and spec type, holding the server address, the type and a checksum of
+// the specdef ahead of the specdef itself. Files are written to a temporary
+// name and renamed, so readers never see a partial file; anything that
+// does not check out is ignored.
+//
+
+void SpecMgr::SetSpecCache( const char *dir ) {
+    cacheDir = dir;
+}
+
+void SpecMgr::SetSpecCacheServer( const char *server ) {
+    if( cacheServer == server )
+	return;
+
+    // Specdefs loaded from the files of the previous server don't apply
+    // to this one, so go back to the built-in defaults
+
+    std::unordered_set<std::string>::iterator i;
+    for( i = cacheChecked.begin(); i != cacheChecked.end(); ++i ) {
+	if( specsAdded.count(*i) )
+	    continue;
+
+	if( specs->GetVar(i->c_str()) )
+	    specs->RemoveVar(i->c_str());
+
+	for( struct specdata *sp = &speclist[0]; sp->type; sp++ ) {
+	    if( *i == sp->type )
+		SetSpecDef(sp->type, StrRef(sp->spec));
+	}
+    }
+
+    cacheServer = server;
+    cacheChecked.clear();
+}
+
+void SpecMgr::SpecCacheFile( const char *type, StrBuf &path ) {
+    path.Clear();
+    path << cacheDir;
+#ifdef _WIN32
+    if( path.Length() && path.Text()[path.Length() - 1] != '\\'
+	    && path.Text()[path.Length() - 1] != '/' )
+	path << "\\";
+#else
+    if( path.Length() && path.Text()[path.Length() - 1] != '/' )
+	path << "/";
+#endif
+
+    // ssl:perforce:1666 -> ssl_perforce_1666
+    StrBuf name;
+    name << cacheServer << "-" << type;
+    for( char * c = name.Text(); *c; c++ ) {
+	if( !isalnum((unsigned char) *c) && *c != '.' && *c != '-' )
+	    *c = '_';
+    }
+
+    path << name << ".spec";
+}
+
+void SpecMgr::LoadSpecDef( const char *type ) {
+    StrBuf path;
+    SpecCacheFile(type, path);
+
+    FILE * f = fopen(path.Text(), "rb");
+    if( !f )
+	return;
+
+    std::string data;
+    char buf[4096];
+    size_t n;
+    while( (n = fread(buf, 1, sizeof(buf), f)) > 0 )
+	data.append(buf, n);
+    fclose(f);
+
+    // server, type and checksum, one per line, then the specdef
+    size_t l1 = data.find('\n');
+    size_t l2 = l1 == std::string::npos ? l1 : data.find('\n', l1 + 1);
+    size_t l3 = l2 == std::string::npos ? l2 : data.find('\n', l2 + 1);
+    if( l3 == std::string::npos )
+	return;
+
+    const char * specDef = data.c_str() + l3 + 1;
+    p4size_t len = (p4size_t) (data.size() - l3 - 1);
+
+    char sum[16];
+    snprintf(sum, sizeof(sum), "%08x", HashKey(specDef, len));
+
+    if( data.compare(0, l1, cacheServer.Text()) != 0
+	    || data.compare(l1 + 1, l2 - l1 - 1, type) != 0
+	    || data.compare(l2 + 1, l3 - l2 - 1, sum) != 0 ) {
+	debug->debug(P4PYDBG_COMMANDS, "[P4] Ignoring stale spec cache file");
+	return;
+    }
+
+    SetSpecDef(type, StrRef(specDef, len));
+}
+
+void SpecMgr::SaveSpecDef( const char *type, const StrPtr &specDef ) {
+    if( !cacheDir.Length() )
+	return;
+
+    // Several P4 objects of one process may save the same file at once,
+    // so the temporary name is unique within the process as well
+    static std::atomic<unsigned> tmpCount( 0 );
+
+    StrBuf path, tmp;
+    SpecCacheFile(type, path);
+    tmp << path << "." << (int) getpid() << "." << (int) tmpCount++ << ".tmp";
+
+    FILE * f = fopen(tmp.Text(), "wb");
+    if( !f ) {
+	debug->debug(P4PYDBG_COMMANDS, "[P4] Cannot write to the spec cache");
+	return;
+    }
+
+    char sum[16];
+    snprintf(sum, sizeof(sum), "%08x", HashKey(specDef.Text(), specDef.Length()));
+
+    StrBuf header;
+    header << cacheServer << "\n" << type << "\n" << sum << "\n";
+
+    bool ok = fwrite(header.Text(), 1, header.Length(), f) == header.Length()
+	    && fwrite(specDef.Text(), 1, specDef.Length(), f) == specDef.Length();
+    ok = fclose(f) == 0 && ok;
+
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows
+    if( ok )
+	remove(path.Text());
+#endif
+
+    if( !ok || rename(tmp.Text(), path.Text()) != 0 ) {
+	debug->debug(P4PYDBG_COMMANDS, "[P4] Cannot write to the spec cache");
+	remove(tmp.Text());
+    }
 }
 
 PyObject * SpecMgr::CreatePyString( const char * s ) {
@@ -411,32 +1027,172 @@ PyObject * SpecMgr::StrDictToDict( StrDict *dict, PyObject * pydict) {
 }
 
 //
-// Convert a Perforce StrDict into a P4.Spec object
+// Convert a Perforce StrDict into a P4.Record. The naming rules are the
+// same as for StrDictToDict(): a plain key that clashes with an earlier
+// one gets an "s" appended, and an indexed key whose base name is already
+// a plain field is kept flat.
 //
 
-PyObject * SpecMgr::StrDictToSpec( StrDict *dict, StrPtr *specDef ) {
-    // This converts it to a string, and then to a dict, so we go from one
-    // type of dictionary to another, via an intermediate form (a StrBuf).
+PyObject * SpecMgr::StrDictToRecord( StrDict *dict ) {
+    P4API_state * st = P4API_GetState();
+    P4Record * record = st ? PyObject_New(P4Record, st->recordType) : NULL;
+    if( !record )
+	return NULL;
+
+    PythonRecord * rec = new PythonRecord(encoding.Text());
+    record->rec = rec;
 
-    SpecDataTable dictData(dict);
-    StrBuf form;
+    PyObject * nested = NULL;
+    StrRef var, val;
 
+    for( int i = 0; dict->GetVar(i, var, val); i++ ) {
+	if( var == "specdef" || var == "func" || var == "specFormatted" )
+	    continue;
+
+	StrBuf base, index;
+	SplitKey(&var, base, index);
+
+	PyObject * key = index == "" ? DictKey(var) : DictKey(base);
+	if( !key )
+	    break;
+
+	if( index == "" ) {
+	    if( rec->Find(key) >= 0 ) {
+		StrBuf plural(var);
+		plural << "s";
+
+		Py_DECREF(key);
+		if( !(key = DictKey(plural)) )
+		    break;
+	    }
+
+	    PyObject * number = TypedValue(key, &val);
+	    if( number ) {
+		rec->AddObject(key, number);
+		Py_DECREF(number);
+	    }
+	    else if( PyErr_Occurred() ) {
+		Py_DECREF(key);
+		break;
+	    }
+	    else {
+		rec->AddValue(key, val);
+	    }
+	}
+	else if( rec->Find(key) >= 0 && !(nested && PyDict_GetItem(nested, key)) ) {
+	    Py_DECREF(key);
+	    if( !(key = DictKey(var)) )
+		break;
+	    rec->AddValue(key, val);
+	}
+	else {
+	    if( !nested && !(nested = PyDict_New()) ) {
+		Py_DECREF(key);
+		break;
+	    }
+
+	    // Reserve the position of the list, it is filled in below
+	    if( !PyDict_GetItem(nested, key) )
+		rec->AddObject(key, Py_None);
+	    else
+		Py_DECREF(key);
+
+	    InsertItem(nested, &var, &val);
+	}
+    }
+
+    if( nested ) {
+	Py_ssize_t pos = 0;
+	PyObject *k, *v;
+
+	while( PyDict_Next(nested, &pos, &k, &v) ) {
+	    int i = rec->Find(k);
+	    if( i >= 0 )
+		rec->SetObject(i, v);
+	}
+	Py_DECREF(nested);
+    }
+
+    if( PyErr_Occurred() ) {
+	Py_DECREF(record);
+	return NULL;
+    }
+
+    return (PyObject *) record;
+}
+
+//
+// A field value of a spec as the form parser would have returned it:
+// text fields always end with a newline.
+//
+
+static PyObject * SpecFieldValue( SpecElem *se, StrPtr *val ) {
+    if( se->IsText() && val->Length() && val->Text()[val->Length() - 1] != '\n' ) {
+	StrBuf text(*val);
+	text << "\n";
+	return CreatePythonString(text.Text());
+    }
+    return CreatePythonString(val->Text());
+}
+
+//
+// Convert a Perforce StrDict into a P4.Spec object. Tagged forms use the
+// field names of the spec as keys, with the index appended for list
+// fields (View0, View1, ...), so we can copy the fields straight across
+// rather than formatting the dict as a form and parsing that again.
+//
+
+PyObject * SpecMgr::StrDictToSpec( StrDict *dict, StrPtr *specDef ) {
     Error e;
-    Spec s(specDef->Text(), "", &e);
+    SpecEntry * entry = CompiledSpec(specDef, &e);
 
-    if( e.Test() )
+    if( !entry ) {
+	if( PyErr_Occurred() )
+	    return NULL;
 	Py_RETURN_FALSE ;
+    }
 
-    // Format the StrDict into a StrBuf object
-    s.Format(&dictData, &form);
+    Spec & s = *entry->spec;
+    PyObject * spec = NewSpec(entry);
+    if( !spec )
+	return NULL;
 
-    // Now parse the StrBuf into a new P4::Spec object
-    PyObject * spec = NewSpec(specDef);
-    PythonSpecData specData(spec);
+    for( int i = 0; i < s.Count(); i++ ) {
+	SpecElem * se = s.Get(i);
+	StrPtr * val;
 
-    s.ParseNoValid(form.Text(), &specData, &e);
-    if( e.Test() )
-	Py_RETURN_FALSE ;
+	if( se->IsList() ) {
+	    PyObject * list = NULL;
+
+	    for( int x = 0; (val = dict->GetVar(se->tag, x)); x++ ) {
+		if( !list && !(list = PyList_New(0)) )
+		    break;
+
+		PyObject * item = SpecFieldValue(se, val);
+		int rc = item ? PyList_Append(list, item) : -1;
+		Py_XDECREF(item);
+		if( rc == -1 )
+		    break;
+	    }
+
+	    if( list ) {
+		PyDict_SetItemString(spec, se->tag.Text(), list);
+		Py_DECREF(list);
+	    }
+	}
+	else if( (val = dict->GetVar(se->tag)) && val->Length() ) {
+	    PyObject * item = SpecFieldValue(se, val);
+	    if( item ) {
+		PyDict_SetItemString(spec, se->tag.Text(), item);
+		Py_DECREF(item);
+	    }
+	}
+
+	if( PyErr_Occurred() ) {
+	    Py_DECREF(spec);
+	    return NULL;
+	}
+    }
 
     // Now see if there are any extraTag fields as we'll need to
     // add those fields into our output. Just iterate over them
@@ -465,17 +1221,25 @@ PyObject * SpecMgr::StrDictToSpec( StrDict *dict, StrPtr *specDef ) {
 }
 
 PyObject * SpecMgr::StringToSpec( const char *type, const char *form, Error *e ) {
-    StrPtr * specDef = specs->GetVar(type);
-    PyObject * spec = NewSpec(specDef);
-    PythonSpecData specData(spec);
+    SpecEntry * entry = CompiledSpec(GetSpecDef(type), e);
 
-    Spec s(specDef->Text(), "", e);
+    if( !entry ) {
+	if( PyErr_Occurred() )
+	    return NULL;
+	Py_RETURN_NONE ;
+    }
+
+    PyObject * spec = NewSpec(entry);
+    if( !spec )
+	return NULL;
 
-    if( !e->Test() )
-	s.ParseNoValid(form, &specData, e);
+    PythonSpecData specData(spec);
+    entry->spec->ParseNoValid(form, &specData, e);
 
-    if( e->Test() )
+    if( e->Test() ) {
+	Py_DECREF(spec);
 	Py_RETURN_NONE ;
+    }
 
     return spec;
 }
@@ -486,7 +1250,7 @@ PyObject * SpecMgr::StringToSpec( const char *type, const char *form, Error *e )
 //
 void SpecMgr::SpecToString( const char *type, PyObject * pydict, StrBuf &b, Error *e ) {
     StrBuf buf;
-    StrPtr * specDef = specs->GetVar(type);
+    StrPtr * specDef = GetSpecDef(type);
 
     if( !specDef ) {
 	e->Set(E_FAILED, "No specdef available. Cannot convert dict to a "
@@ -494,13 +1258,12 @@ void SpecMgr::SpecToString( const char *type, PyObject * pydict, StrBuf &b, Erro
 	return;
     }
 
-    PythonSpecData specData(pydict);
-
-    Spec s(specDef->Text(), "", e);
-    if( e->Test() )
+    SpecEntry * entry = CompiledSpec(specDef, e);
+    if( !entry )
 	return;
 
-    s.Format(&specData, &b);
+    PythonSpecData specData(pydict);
+    entry->spec->Format(&specData, &b);
 }
 
 //
@@ -512,22 +1275,31 @@ void SpecMgr::SpecToString( const char *type, PyObject * pydict, StrBuf &b, Erro
 //
 
 PyObject * SpecMgr::SpecFields( const char *type ) {
-    return SpecFields(specs->GetVar(type));
+    return SpecFields(GetSpecDef(type));
 }
 
 PyObject * SpecMgr::SpecFields( StrPtr *specDef ) {
     if( !specDef )
 	Py_RETURN_NONE ;
 
-    PyObject * dict = PyDict_New();
-
     Error e;
+    SpecEntry * entry = CompiledSpec(specDef, &e);
 
-    Spec s(specDef->Text(), "", &e);
-    if( e.Test() )
+    if( !entry ) {
+	if( PyErr_Occurred() )
+	    return NULL;
 	Py_RETURN_NONE ;
+    }
 
-    for( int i = 0; i < s.Count(); i++ ) {
+    return PyDict_Copy(P4Spec_FieldMap(entry->fields));
+}
+
+PyObject * SpecMgr::FieldMap( Spec *s ) {
+    PyObject * dict = PyDict_New();
+    if( !dict )
+	return NULL;
+
+    for( int i = 0; i < s->Count(); i++ ) {
 	//
 	// Here we abuse the fact that SpecElem::tag is public, even though it's
 	// only supposed to be public to SpecData's subclasses. It's hard to
@@ -535,7 +1307,7 @@ PyObject * SpecMgr::SpecFields( StrPtr *specDef ) {
 	// reliable. So...
 	//
 
-	SpecElem * se = s.Get(i);
+	SpecElem * se = s->Get(i);
 	StrBuf v = se->tag;
 	StrBuf k = v;
 
@@ -546,12 +1318,83 @@ PyObject * SpecMgr::SpecFields( StrPtr *specDef ) {
 	    PyDict_SetItemString(dict, k.Text(), str);
 	    Py_DECREF(str);
 	} else {
+	    Py_DECREF(dict);
 	    return NULL;
 	}
     }
     return dict;
 }
 
+//
+// Returns the parsed form of a specdef, from the cache if we have seen it
+// before. The entry belongs to the cache and is only valid until the next
+// call. Returns 0 with e set if the specdef cannot be parsed, or with a
+// Python exception if the field map cannot be created.
+//
+
+SpecMgr::SpecEntry * SpecMgr::CompiledSpec( StrPtr *specDef, Error *e ) {
+    if( !specDef ) {
+	e->Set(E_FAILED, "No specdef available");
+	return 0;
+    }
+
+    std::string text(specDef->Text(), specDef->Length());
+    std::unordered_map<std::string, SpecList::iterator>::iterator found
+	= specIndex.find(text);
+
+    if( found != specIndex.end() ) {
+	specHits++;
+	specCache.splice(specCache.begin(), specCache, found->second);
+	return &found->second->second;
+    }
+
+    specMisses++;
+
+    Spec * s = new Spec(specDef->Text(), "", e);
+    if( e->Test() ) {
+	delete s;
+	return 0;
+    }
+
+    PyObject * map = FieldMap(s);
+    PyObject * fields = map ? P4Spec_NewFields(map) : NULL;
+    Py_XDECREF(map);
+    if( !fields ) {
+	delete s;
+	return 0;
+    }
+
+    if( specCache.size() >= MAX_SPECS ) {
+	SpecEntry & old = specCache.back().second;
+	specIndex.erase(specCache.back().first);
+	delete old.spec;
+	Py_DECREF(old.fields);
+	specCache.pop_back();
+    }
+
+    specCache.push_front(SpecCacheEntry(text, SpecEntry(s, fields)));
+    specIndex[text] = specCache.begin();
+
+    return &specCache.front().second;
+}
+
+void SpecMgr::ClearSpecs() {
+    specIndex.clear();
+
+    for( SpecList::iterator i = specCache.begin(); i != specCache.end(); ++i ) {
+	delete i->second.spec;
+	Py_DECREF(i->second.fields);
+    }
+    specCache.clear();
+}
+
+PyObject * SpecMgr::SpecCacheStats() {
+    return Py_BuildValue("{s:k,s:k,s:n}",
+	    "hits", specHits,
+	    "misses", specMisses,
+	    "size", (Py_ssize_t) specCache.size());
+}
+
 //
 // Split a key into its base name and its index. i.e. for a key "how1,0"
 // the base name is "how" and they index is "1,0". We work backwards from
@@ -598,34 +1441,52 @@ void SpecMgr::InsertItem( PyObject * dict, const StrPtr *var, const StrPtr *val
     // value
 
     if( index == "" ) {
-	StrBuf key(*var);
-
-	if( PyDict_GetItemString(dict, key.Text()) )
-	    key << "s";
+	StrBuf name(*var);
+	PyObject * key = DictKey(name);
+	if( !key )
+	    return;
+
+	if( PyDict_GetItem(dict, key) ) {
+	    name << "s";
+
+	    Py_DECREF(key);
+	    key = DictKey(name);
+	    if( !key )
+		return;
+	}
 
-	StrBuf buf("... ");
-	buf << key.Text() << " -> " << val->Text();
+	if( debug->enabled( P4PYDBG_DATA ) ) {
+	    StrBuf buf("... ");
+	    buf << name.Text() << " -> " << val->Text();
 
-	debug->debug ( P4PYDBG_DATA, buf.Text() );
+	    debug->debug ( P4PYDBG_DATA, buf.Text() );
+	}
 
-	PyObject * str = CreatePyString(val->Text());
+	PyObject * str = CreateValue(key, val);
 	if( str ) {
-	    PyDict_SetItemString(dict, key.Text(), str);
+	    PyDict_SetItem(dict, key, str);
 	    Py_DECREF(str);
 	}
+	Py_DECREF(key);
 	return;
     }
 
     //
     // Get or create the parent array from the dict.
     //
-    PyObject * list = PyDict_GetItemString(dict, base.Text());
+    PyObject * baseKey = DictKey(base);
+    if( !baseKey )
+	return;
+
+    PyObject * list = PyDict_GetItem(dict, baseKey);
 
     if( NULL == list ) {
 	list = PyList_New(0);
-	PyDict_SetItemString(dict, base.Text(), list);
+	PyDict_SetItem(dict, baseKey, list);
 	Py_DECREF(list);
-    } else if( !PyList_Check(list)) {
+    }
+
+    if( !PyList_Check(list) ) {
 	//
 	// There's an index in our var name, but the name is already defined
 	// and the value it contains is not an array. This means we've got a
@@ -635,16 +1496,19 @@ void SpecMgr::InsertItem( PyObject * dict, const StrPtr *var, const StrPtr *val
 	// just use the raw variable name.
 	//
 
-	StrBuf buf("... ");
-	buf << var->Text() << " -> " << val->Text();
+	if( debug->enabled( P4PYDBG_DATA ) ) {
+	    StrBuf buf("... ");
+	    buf << var->Text() << " -> " << val->Text();
 
-	debug->debug ( P4PYDBG_DATA, buf.Text() );
+	    debug->debug ( P4PYDBG_DATA, buf.Text() );
+	}
 
 	PyObject * str = CreatePyString(val->Text());
 	if( str ) {
-	    PyDict_SetItemString(dict, var->Text(), str);
+	    SetItem(dict, *var, str);
 	    Py_DECREF(str);
 	}
+	Py_DECREF(baseKey);
 	return;
     }
 
@@ -652,10 +1516,14 @@ void SpecMgr::InsertItem( PyObject * dict, const StrPtr *var, const StrPtr *val
     // list of digits. For each "level" in the index, we need a containing
     // array.
 
-    StrBuf buf("... ");
-    buf << base.Text() << " -> [";
+    bool verbose = debug->enabled( P4PYDBG_DATA );
 
-    debug->debug ( P4PYDBG_DATA, buf.Text() );
+    if( verbose ) {
+	StrBuf buf("... ");
+	buf << base.Text() << " -> [";
+
+	debug->debug ( P4PYDBG_DATA, buf.Text() );
+    }
 
     for( const char *c = 0; (c = index.Contains(comma)); ) {
 	StrBuf level;
@@ -690,10 +1558,12 @@ void SpecMgr::InsertItem( PyObject * dict, const StrPtr *var, const StrPtr *val
 	    }
 	}
 
-	StrBuf buf("... ");
-	buf << level.Text() << "][";
+	if( verbose ) {
+	    StrBuf buf("... ");
+	    buf << level.Text() << "][";
 
-	debug->debug ( P4PYDBG_DATA, buf.Text() );
+	    debug->debug ( P4PYDBG_DATA, buf.Text() );
+	}
 
 	list = tlist;
     }
@@ -702,12 +1572,15 @@ void SpecMgr::InsertItem( PyObject * dict, const StrPtr *var, const StrPtr *val
 	PyList_Append(list, Py_None);
     }
 
-    buf = "... ";
-    buf << (int)PyList_Size(list) << "] = " << val->Text();
+    if( verbose ) {
+	StrBuf buf("... ");
+	buf << (int)PyList_Size(list) << "] = " << val->Text();
 
-    debug->debug ( P4PYDBG_DATA, buf.Text() );
+	debug->debug ( P4PYDBG_DATA, buf.Text() );
+    }
 
-    PyObject * str = CreatePyString(val->Text());
+    PyObject * str = CreateValue(baseKey, val);
+    Py_DECREF(baseKey);
     if( str ) {
 	PyList_Append(list, str);
 	Py_DECREF(str);
@@ -715,24 +1588,12 @@ void SpecMgr::InsertItem( PyObject * dict, const StrPtr *var, const StrPtr *val
 }
 
 //
-// Create a new P4.Spec object and return it.
+// Create a new P4.Spec object and return it. All specs of a specdef share
+// its field table.
 //
 
-PyObject * SpecMgr::NewSpec( StrPtr *specDef ) {
-    PyObject * module = PyImport_ImportModule("P4");
-    if( module == NULL ) {
-	cerr << "Cannot find module P4, using <dict> instead of P4.Spec"
-		<< endl;
-	return PyDict_New();
-    }
-
-    PyObject * fields = SpecFields(specDef);
-    PyObject * newObj = PyObject_CallMethod(module, (char*) "Spec",
-	    (char*) "(O)", fields);
-    if( newObj == NULL ) {
-	cout << "WARNING : could not find spec !!!" << endl;
-    }
-    return newObj;
+PyObject * SpecMgr::NewSpec( SpecEntry *entry ) {
+    return P4Spec_New(entry->fields);
 }
 
 }
@@ -39,7 +39,14 @@ $Id: //depot/main/p4-python/SpecMgr.h#10 $
 #ifndef SPEC_MGR_H
 #define SPEC_MGR_H
 
+#include <vector>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
 class StrBufDict;
+class Spec;
 
 namespace p4py {
 
@@ -49,7 +56,7 @@ public:
 	SpecMgr(PythonDebug * dbg);
 	~SpecMgr();
 	
-	void		SetEncoding( const char * e )	{ encoding = e; }
+	void		SetEncoding( const char * e )	{ encoding = e; ClearValues(); ClearSpecs(); }
 	const char *	GetEncoding()			{ return encoding.Text(); }
 
 	PyObject * CreatePyString(const char * text);
@@ -65,6 +72,15 @@ public:
 	// Check that a type of spec is known.
 	int	HaveSpecDef( const char *type );
 
+	//
+	// Optional directory where the specdefs sent by the server are kept
+	// for later processes, per server address. An empty string disables
+	// the cache.
+	//
+	void	SetSpecCache( const char *dir );
+	const char *	GetSpecCache()		{ return cacheDir.Text(); }
+	void	SetSpecCacheServer( const char *server );
+
 	//
 	// Parse routine: converts strings into Python P4.Spec objects.
 	//
@@ -83,6 +99,13 @@ public:
     //
 	PyObject * StrDictToDict( StrDict *dict, PyObject * pydict = NULL );
 
+	//
+	// Convert a Perforce StrDict into a P4.Record, which only decodes
+	// the values of plain fields when they are accessed. Indexed fields
+	// are converted into nested lists straight away.
+	//
+	PyObject * StrDictToRecord( StrDict *dict );
+
 	// 
 	// Convert a Perforce StrDict into a P4.Spec object. This is for
 	// 2005.2 and later servers where the forms are supplied pre-parsed
@@ -98,17 +121,133 @@ public:
 	//
 	PyObject * SpecFields( const char *type );
 
+	// Returns a dict with the hits, misses and size of the cache of
+	// parsed spec definitions
+	PyObject * SpecCacheStats();
+
+	//
+	// Dict keys of tagged output are looked up in a table of interned
+	// strings, so each field name is only created and hashed once.
+	// Returns a new reference.
+	//
+	PyObject * DictKey( const char * name, p4size_t len );
+	PyObject * DictKey( const StrPtr &name )
+			{ return DictKey( name.Text(), name.Length() ); }
+
+	// Returns a dict with the hits, misses and size of the key table
+	PyObject * KeyCacheStats();
+
+	//
+	// Optional LRU cache for the values of low-cardinality fields such
+	// as action or type, so that equal values share one object. Only
+	// the fields in the allow-list are cached. A capacity of 0 disables
+	// the cache.
+	//
+	void	SetValueCacheSize( int size );
+	int	GetValueCacheSize()		{ return valueCapacity; }
+	int	SetValueCacheFields( PyObject * fields );
+	PyObject * GetValueCacheFields();
+	PyObject * ValueCacheStats();
+
+	// Creates the value of a field, using the value cache if enabled.
+	// The key must have been obtained from DictKey().
+	PyObject * CreateValue( PyObject * key, const StrPtr *val );
+
+	//
+	// Typed mode: numeric fields listed in the schema of the current
+	// command are returned as ints rather than strings. The schemas map
+	// command names to lists of field names; setting None restores the
+	// built-in schemas.
+	//
+	void	SetTyped( int t )		{ typed = t != 0; }
+	int	GetTyped()			{ return typed; }
+	void	SetCommand( const char * cmd );
+	int	SetTypedFields( PyObject * schemas );
+	PyObject * GetTypedFields();
+
 private:
 
 	static void	SplitKey( const StrPtr *key, StrBuf &base, StrBuf &index );
 	void	InsertItem( PyObject * pydict, const StrPtr *var, const StrPtr *val );
-	PyObject * NewSpec( StrPtr *specDef );
+	bool	SetSpecDef( const char *type, const StrPtr &specDef );
+	StrPtr * GetSpecDef( const char *type );
+	void	SpecCacheFile( const char *type, StrBuf &path );
+	void	LoadSpecDef( const char *type );
+	void	SaveSpecDef( const char *type, const StrPtr &specDef );
+
+	struct SpecEntry;
+
+	SpecEntry * CompiledSpec( StrPtr *specDef, Error *e );
+	PyObject * FieldMap( Spec *s );
+	void	ClearSpecs();
+	PyObject * NewSpec( SpecEntry *entry );
 	PyObject * SpecFields( StrPtr *specDef );
+	int	SetItem( PyObject * dict, const StrPtr &key, PyObject * value );
+	void	ClearValues();
+	int	InternFields( PyObject * fields, const char * msg,
+				std::vector<PyObject *> &interned );
+	void	ClearTypedFields();
+	void	DefaultTypedFields();
+	PyObject * TypedValue( PyObject * key, const StrPtr *val );
 	
 private:
+	struct KeyEntry {
+		KeyEntry() : hash( 0 ), key( 0 ) {}
+
+		unsigned int	hash;
+		StrBuf		name;
+		PyObject *	key;
+	};
+
 	StrBuf		encoding;
 	PythonDebug *	debug;
 	StrBufDict *	specs;
+
+	StrBuf		cacheDir;		// spec cache, see SetSpecCache()
+	StrBuf		cacheServer;
+	std::unordered_set<std::string> cacheChecked;	// types looked up
+	std::unordered_set<std::string> specsAdded;	// from the server or user
+
+	std::vector<KeyEntry>	keys;	// open addressing, size is a power of 2
+	size_t		keyCount;
+	unsigned long	keyHits;
+	unsigned long	keyMisses;
+
+	typedef std::pair<std::string, PyObject *>	ValueEntry;
+	typedef std::list<ValueEntry>			ValueList;
+
+	std::vector<PyObject *>	valueFields;	// interned keys
+	ValueList		values;		// most recently used first
+	std::unordered_map<std::string, ValueList::iterator> valueIndex;
+	size_t		valueCapacity;
+	unsigned long	valueHits;
+	unsigned long	valueMisses;
+
+	//
+	// Parsed spec definitions with their field maps, keyed by the text
+	// of the specdef, as the server sends the same one with every form
+	//
+	struct SpecEntry {
+		SpecEntry( Spec * s, PyObject * f ) : spec( s ), fields( f ) {}
+
+		Spec *		spec;
+		PyObject *	fields;		// field table, see P4Spec_NewFields()
+	};
+
+	typedef std::pair<std::string, SpecEntry>	SpecCacheEntry;
+	typedef std::list<SpecCacheEntry>		SpecList;
+
+	SpecList	specCache;		// most recently used first
+	std::unordered_map<std::string, SpecList::iterator> specIndex;
+	unsigned long	specHits;
+	unsigned long	specMisses;
+
+	typedef std::unordered_map<std::string, std::vector<PyObject *> > SchemaMap;
+
+	bool		typed;
+	SchemaMap	typedSchemas;		// interned keys per command
+	std::string	command;
+	std::vector<PyObject *> * typedFields;	// schema of command, or 0
 };
 }
 #endif
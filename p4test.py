@@ -28,6 +28,8 @@ import os.path
 import re
 import platform
 import pickle
+import copy
+import warnings
 
 def onRmTreeError( function, path, exc_info ):
     os.chmod( path, stat.S_IWRITE)
@@ -979,6 +981,529 @@ class TestP4(TestP4Python):
         self.p4.run_info()
         self.assertTrue(len(self.p4.track_output), "No performance tracking reported")
 
+        stats = self.p4.track_stats
+        self.assertTrue(isinstance(stats['lapse'], float), "No lapse time in track_stats")
+        self.assertTrue('msgs_in' in stats['rpc'], "No rpc statistics in track_stats")
+        for name, table in stats['tables'].items():
+            if name.startswith('db.') and 'pages_in' in table:
+                self.assertTrue(isinstance(table['pages_in'], int))
+
+    def testSpecConversion( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-spec-conversion'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Spec Conversion Test\nwith two lines"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        # tagged forms must come out as if the form had been parsed
+        client = self.p4.fetch_client()
+        self.assertTrue( isinstance(client, P4.Spec), "Not a P4.Spec" )
+        self.assertTrue( isinstance(client._view, list) )
+        self.assertEqual( client, self.p4.parse_client(self.p4.format_client(client)) )
+
+        self.p4.run_edit(testDir + "/" + files[0])
+        pending = self.p4.fetch_change()
+        self.assertEqual( pending._files, ["//depot/%s/%s" % (testDir, files[0])] )
+        self.assertEqual( pending, self.p4.parse_change(self.p4.format_change(pending)) )
+        self.p4.run_revert('...')
+
+        submitted = self.p4.fetch_change('1')
+        self.assertTrue( submitted._description.endswith("with two lines\n") )
+        self.assertEqual( submitted, self.p4.parse_change(self.p4.format_change(submitted)) )
+
+    def testSpecCacheDir( self ):
+        import tempfile, shutil
+        cacheDir = tempfile.mkdtemp()
+        try:
+            specdef = "Name;code:1;rq;len:32;;Notes;code:2;type:text;len:128;;"
+            form = "Name:\tfoo\n\nNotes:\n\tsome notes\n"
+
+            self.p4.spec_cache = cacheDir
+            self.assertEqual( self.p4.spec_cache, cacheDir )
+            self.p4.define_spec('thing', specdef)
+            self.assertEqual( len(os.listdir(cacheDir)), 1, "specdef not written" )
+
+            # a fresh P4 for the same server finds it without a command
+            p4 = P4.P4()
+            p4.port = self.p4.port
+            self.assertRaises( P4.P4Exception, p4.parse_spec, 'thing', form )
+            p4.spec_cache = cacheDir
+            spec = p4.parse_spec('thing', form)
+            self.assertEqual( spec['Name'], 'foo' )
+            self.assertEqual( spec['Notes'], 'some notes\n' )
+
+            # which no longer applies once the port has changed
+            p4.port = 'some-other-server:1666'
+            self.assertRaises( P4.P4Exception, p4.parse_spec, 'thing', form )
+
+            # nor for another server
+            p4 = P4.P4()
+            p4.port = 'some-other-server:1666'
+            p4.spec_cache = cacheDir
+            self.assertRaises( P4.P4Exception, p4.parse_spec, 'thing', form )
+
+            # damaged files are ignored
+            name = os.path.join(cacheDir, os.listdir(cacheDir)[0])
+            with open(name, "ab") as f:
+                f.write(b"garbage")
+            p4 = P4.P4()
+            p4.port = self.p4.port
+            p4.spec_cache = cacheDir
+            self.assertRaises( P4.P4Exception, p4.parse_spec, 'thing', form )
+        finally:
+            self.p4.spec_cache = ""
+            shutil.rmtree(cacheDir)
+
+    def testSpecCache( self ):
+        self.p4.connect()
+        self._setClient()
+
+        self.p4.fetch_client()
+        before = self.p4.spec_cache_stats
+        for i in range(5):
+            client = self.p4.fetch_client()
+            self.p4.parse_client(self.p4.format_client(client))
+        after = self.p4.spec_cache_stats
+
+        # the client specdef is only parsed once
+        self.assertEqual( after['misses'], before['misses'] )
+        self.assertTrue( after['hits'] >= before['hits'] + 15 )
+        self.assertTrue( 0 < after['size'] <= 32 )
+
+        # the field map cannot be changed through a spec
+        self.assertRaises( TypeError, client.permitted_fields().__setitem__, 'bogus', 'Bogus' )
+        self.assertFalse( 'bogus' in self.p4.fetch_client().permitted_fields() )
+
+    def testNativeSpec( self ):
+        self.p4.connect()
+        self._setClient()
+
+        client = self.p4.fetch_client()
+        self.assertTrue( isinstance(client, P4.Spec), "Not a P4.Spec" )
+        self.assertTrue( isinstance(client, P4API.P4Spec), "Not a P4API.P4Spec" )
+        self.assertTrue( isinstance(client, dict), "Not a dict" )
+
+        # shortcuts are case insensitive
+        self.assertEqual( client._client, client['Client'] )
+        self.assertEqual( client._Client, client['Client'] )
+        self.assertEqual( client._bogus, None )
+        self.assertRaises( AttributeError, getattr, client, 'bogus' )
+
+        client._description = "Set through a shortcut\n"
+        self.assertEqual( client['Description'], "Set through a shortcut\n" )
+        client['description'] = "Set through a lower case key\n"
+        self.assertEqual( client['Description'], "Set through a lower case key\n" )
+        self.assertFalse( 'description' in client )
+        client['View'] = [ "//depot/... //%s/..." % client._client ]
+
+        self.assertRaises( P4.P4Exception, client.__setitem__, 'Bogus', 'value' )
+        self.assertRaises( P4.P4Exception, setattr, client, '_bogus', 'value' )
+        self.assertRaises( P4.P4Exception, client.__setitem__, 'Root', 42 )
+        self.assertRaises( AttributeError, setattr, client, 'bogus', 'value' )
+
+        # all clients share one field table
+        other = self.p4.fetch_client('other')
+        self.assertEqual( other.permitted_fields(), client.permitted_fields() )
+
+        # comments, copies and pickles
+        client.comment = "# A comment\n"
+        for c in (copy.copy(client), copy.deepcopy(client), pickle.loads(pickle.dumps(client))):
+            self.assertTrue( isinstance(c, P4.Spec) )
+            self.assertEqual( c, client )
+            self.assertEqual( c.comment, client.comment )
+            self.assertEqual( dict(c.permitted_fields()), dict(client.permitted_fields()) )
+            self.assertRaises( P4.P4Exception, c.__setitem__, 'Bogus', 'value' )
+
+        # specs made in Python work as before
+        spec = P4.Spec({'name': 'Name'})
+        spec._name = 'foo'
+        self.assertEqual( spec, {'Name': 'foo'} )
+        self.assertRaises( P4.P4Exception, spec.__setitem__, 'Other', 'value' )
+        unchecked = P4.Spec()
+        unchecked['Anything'] = 'goes'
+        self.assertEqual( unchecked.permitted_fields(), None )
+
+    def testStatChunk( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-stat-chunk'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Stat Chunk Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        plain = self.p4.run_fstat('...')
+        self.assertEqual( self.p4.stat_chunk, 0, "stat_chunk not off by default")
+
+        # chunks smaller than, equal to and larger than the output
+        for n in (1, 2, len(plain), 1000):
+            chunked = self.p4.run_fstat('...', stat_chunk=n)
+            self.assertEqual( chunked, plain, "stat_chunk=%d changed the output" % n )
+        self.assertEqual( self.p4.stat_chunk, 0, "stat_chunk not restored")
+
+        records = self.p4.run_fstat('...', stat_chunk=2, lazy_records=True)
+        self.assertTrue( isinstance(records[0], P4.Record), "Not a P4.Record" )
+        self.assertEqual( records, plain )
+
+        # output interleaved with messages keeps its order
+        with self.p4.at_exception_level(P4.P4.RAISE_NONE):
+            missing = self.p4.run_fstat('...', 'no-such-file', stat_chunk=1000)
+        self.assertEqual( missing, plain )
+        self.assertEqual( len(self.p4.warnings), 1 )
+
+        # forms are still converted to specs
+        client = self.p4.run_client('-o', stat_chunk=10)[0]
+        self.assertTrue( isinstance(client, P4.Spec), "Not a P4.Spec" )
+
+        self.p4.stat_chunk = 4
+        self.assertEqual( self.p4.run_fstat('...'), plain )
+        self.assertEqual( self.p4.last_command_stats['stat_records'], len(plain) )
+        self.assertEqual( list(self.p4.run_iter('fstat', '...')), plain )
+        self.p4.stat_chunk = 0
+
+    def testSubInterpreters( self ):
+        try:
+            import _interpreters as interpreters
+        except ImportError:
+            try:
+                import _xxsubinterpreters as interpreters
+            except ImportError:
+                self.skipTest("sub-interpreters are not available")
+
+        self.p4.connect()
+
+        code = "\n".join([
+            "import P4",
+            "p4 = P4.P4(port=%r)" % self.port,
+            "p4.connect()",
+            "assert p4.run_info()[0]['serverAddress']",
+            "try:",
+            "    p4.run_fstat('//depot/no/such/file')",
+            "    raise AssertionError('no exception')",
+            "except P4.P4Exception:",
+            "    pass",
+            "p4.disconnect()",
+        ])
+
+        interp = interpreters.create()
+        try:
+            self.assertIsNone( interpreters.run_string(interp, code) )
+        finally:
+            interpreters.destroy(interp)
+
+        # the module of the main interpreter is not affected
+        with self.assertRaises(P4.P4Exception):
+            self.p4.run_fstat('//depot/no/such/file')
+        self.assertTrue( self.p4.run_info()[0]['serverAddress'] )
+
+    def testFreeThreading( self ):
+        import threading, sysconfig
+
+        # importing P4API must not turn the GIL back on
+        if sysconfig.get_config_var('Py_GIL_DISABLED'):
+            self.assertFalse( sys._is_gil_enabled() )
+
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-free-threading'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Free Threading Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        shared = self.p4.run_fstat('//depot/%s/...' % testDir, lazy_records=True)
+        errors = []
+
+        def worker():
+            try:
+                p4 = P4.P4(port=self.port, client=self.p4.client)
+                p4.connect()
+                for i in range(10):
+                    result = p4.run_fstat('//depot/%s/...' % testDir)
+                    self.assertEqual( len(result), len(files) )
+                    for r in shared:
+                        self.assertEqual( r['headRev'], '1' )
+                p4.disconnect()
+            except Exception as e:
+                errors.append(e)
+
+        threads = [ threading.Thread(target=worker) for i in range(4) ]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        self.assertEqual( errors, [] )
+
+    def testRunAsync( self ):
+        import asyncio
+
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-run-async'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Async Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        async def run():
+            ticks = 0
+            task = asyncio.ensure_future(self.p4.run_async('files', '//depot/%s/...' % testDir))
+            while not task.done():
+                ticks += 1
+                await asyncio.sleep(0)
+            result = task.result()
+
+            streamed = []
+            async for f in self.p4.run_async_iter('fstat', '//depot/%s/...' % testDir):
+                streamed.append(f['depotFile'])
+
+            with self.assertRaises(P4.P4Exception):
+                await self.p4.run_async('fstat', '//depot/no/such/file')
+
+            # a second command on a busy connection fails loudly
+            stream = self.p4.run_async_iter('fstat', '//depot/%s/...' % testDir)
+            await stream.__anext__()
+            with warnings.catch_warnings():
+                warnings.simplefilter("ignore")
+                with self.assertRaises(P4.P4Exception):
+                    await self.p4.run_async('files', '//depot/%s/...' % testDir)
+            await stream.aclose()
+
+            return (ticks, result, streamed)
+
+        (ticks, result, streamed) = asyncio.run(run())
+        self.assertTrue( ticks > 0 )
+        self.assertEqual( len(result), len(files) )
+        self.assertEqual( len(streamed), len(files) )
+        self.assertEqual( len(self.p4.run_files('//depot/%s/...' % testDir)), len(files) )
+
+    def testRunPipelined( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-run-pipelined'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Pipelined Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        paths = [ "//depot/%s/%s" % (testDir, f) for f in files ]
+        commands = [ ("fstat", p) for p in paths ]
+        commands.append( ["fstat", "//depot/no/such/file"] )
+        commands.append( "info" )
+        commands.append( ("counter", "change") )
+
+        results = self.p4.run_pipelined(commands, depth=2)
+        self.assertEqual( len(results), len(commands) )
+        for (p, r) in zip(paths, results):
+            self.assertEqual( r[0]['depotFile'], p )
+        self.assertTrue( isinstance(results[3], P4.P4Exception) )
+        self.assertEqual( results[4][0]['userName'], self.p4.user )
+        self.assertEqual( results[5][0]['value'], "1" )
+
+        with self.assertRaises(ValueError):
+            self.p4.run_pipelined(commands, 0)
+
+        # the connection is usable as usual afterwards
+        self.assertEqual( len(self.p4.run_files('//depot/%s/...' % testDir)), len(files) )
+
+    def testRunMany( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-run-many'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Run Many Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        paths = [ "//depot/%s/%s" % (testDir, f) for f in files ]
+        commands = [ ("fstat", p) for p in paths ]
+        commands.append( ("fstat", "//depot/no/such/file") )
+        commands.append( "info" )
+
+        results = self.p4.run_many(commands, parallelism=3)
+        self.assertEqual( len(results), len(commands) )
+        for (p, r) in zip(paths, results):
+            self.assertEqual( r[0]['depotFile'], p )
+        self.assertTrue( isinstance(results[-2], P4.P4Exception) )
+        self.assertEqual( results[-1][0]['userName'], self.p4.user )
+
+        completed = list(self.p4.run_many(commands, parallelism=2, ordered=False))
+        self.assertEqual( sorted(i for (i, r) in completed), list(range(len(commands))) )
+
+        with self.assertRaises(ValueError):
+            self.p4.run_many(commands, parallelism=0)
+
+        self.assertTrue( self.p4.connected() )
+
+        # the worker connections are of the caller's class
+        class CountingP4(P4.P4):
+            connects = 0
+            def connect(self):
+                CountingP4.connects += 1
+                return P4.P4.connect(self)
+
+        p4 = CountingP4(port=self.p4.port, user=self.p4.user, client=self.p4.client)
+        self.assertEqual( len(p4.run_many(commands, parallelism=2)), len(commands) )
+        self.assertEqual( CountingP4.connects, 2 )
+
+    def testPool( self ):
+        import threading
+
+        with P4.Pool(2, port=self.port) as pool:
+            first = pool.checkout()
+            self.assertTrue( first.connected() )
+            second = pool.checkout()
+            self.assertFalse( first is second )
+
+            with self.assertRaises(P4.P4Exception):
+                pool.checkout(timeout=0.1)
+
+            pool.checkin(first)
+            with self.assertRaises(ValueError):
+                pool.checkin(first)
+
+            with pool.connection() as p4:
+                self.assertTrue( p4 is first )
+
+            # a dropped connection is reconnected on the next checkout
+            first.disconnect()
+            with pool.connection() as p4:
+                self.assertTrue( p4.connected() )
+                p4.run_info()
+            pool.checkin(second)
+
+            results = []
+            def worker():
+                for i in range(5):
+                    with pool.connection(timeout=30) as p4:
+                        results.append(p4.run_info()[0]['serverRoot'])
+
+            threads = [ threading.Thread(target=worker) for i in range(4) ]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+
+            self.assertEqual( len(results), 20 )
+            stats = pool.stats()
+            self.assertEqual( stats['connections'], 2 )
+            self.assertEqual( stats['idle'], 2 )
+            self.assertEqual( stats['reconnects'], 1 )
+            # the timed out checkout is not counted
+            self.assertEqual( stats['checkouts'], 24 )
+
+        self.assertFalse( first.connected() )
+        with self.assertRaises(P4.P4Exception):
+            pool.checkout()
+
+        # reconnects go through connect() just like new connections
+        class CountingP4(P4.P4):
+            connects = 0
+            def connect(self):
+                CountingP4.connects += 1
+                return P4.P4.connect(self)
+
+        with P4.Pool(1, factory=lambda: CountingP4(port=self.port)) as pool:
+            with pool.connection() as p4:
+                p4.disconnect()
+            with pool.connection() as p4:
+                self.assertTrue( p4.connected() )
+        self.assertEqual( CountingP4.connects, 2 )
+
+        # a streamed command left open is abandoned on checkin
+        with P4.Pool(1, port=self.port) as pool:
+            with pool.connection() as p4:
+                pending = p4.run_iter('info')
+            with pool.connection() as p4:
+                self.assertEqual( len(p4.run_info()), 1 )
+            self.assertEqual( list(pending), [] )
+
+    def testLastCommandStats( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-command-stats'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Command Stats Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        result = self.p4.run_files('...')
+        stats = self.p4.last_command_stats
+        self.assertEqual( stats['command'], 'files' )
+        self.assertEqual( stats['stat_records'], len(files) )
+        self.assertEqual( stats['results'], len(result) )
+        self.assertEqual( stats['peak_result_count'], len(result) )
+        self.assertTrue( stats['bytes'] > 0 )
+        self.assertTrue( stats['run_time'] >= stats['convert_time'] )
+        self.assertEqual( stats['callback_time'], 0.0 )
+
+        # a streamed command is only reported once it has finished
+        iterator = self.p4.run_iter('fstat', '...', iter_buffer=1)
+        self.assertEqual( self.p4.last_command_stats['command'], 'files' )
+        self.assertEqual( len(list(iterator)), len(files) )
+        stats = self.p4.last_command_stats
+        self.assertEqual( stats['command'], 'fstat' )
+        self.assertEqual( stats['results'], len(files) )
+        self.assertEqual( stats['peak_result_count'], 1 )
+
+        class MyHandler(P4.OutputHandler):
+            def outputStat(self, stat):
+                return P4.OutputHandler.HANDLED
+
+        self.p4.run_files('...', handler=MyHandler())
+        stats = self.p4.last_command_stats
+        self.assertTrue( stats['callback_time'] > 0.0 )
+        self.assertEqual( stats['results'], 0 )
+
+    def testTrace( self ):
+        self.assertEqual( self.p4.trace_size, 0 )
+        self.assertEqual( self.p4.trace_events, [] )
+
+        self.p4.trace_size = 4
+        self.p4.connect()
+        self.p4.run_info()
+        self.p4.run_info()
+        self.p4.run_info()
+
+        events = self.p4.trace_events
+        self.assertEqual( len(events), 4, "Ring buffer not bounded" )
+        self.assertTrue( all(e['time'] >= 0 for e in events) )
+        times = [ e['time'] for e in events ]
+        self.assertEqual( times, sorted(times), "Events not in order" )
+
+        self.p4.trace_size = 100
+        try:
+            self.p4.run_files('//no/such/path/...')
+        except P4.P4Exception:
+            pass
+        events = self.p4.trace_events
+        self.assertEqual( events[0]['event'], 'run' )
+        self.assertEqual( events[0]['detail'], 'files' )
+
     def testOutputHandler( self ):
         self.assertEqual( self.p4.handler, None )
 
@@ -1029,6 +1554,346 @@ class TestP4(TestP4Python):
         self.assertEqual( len(h.messageOutput), 0, "Messages unexpected")
         self.p4.handler = None
 
+    def testKeyCache( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-key-cache'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Key Cache Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        self.p4.run_files('...')
+        before = self.p4.key_cache_stats
+        result = self.p4.run_files('...')
+        after = self.p4.key_cache_stats
+
+        self.assertEqual( after['misses'], before['misses'], "Keys not cached")
+        self.assertEqual( after['hits'] - before['hits'], sum( len(x) for x in result ),
+                          "Unexpected number of key lookups")
+
+        # keys are shared between records
+        self.assertTrue( list(result[0].keys())[0] is list(result[1].keys())[0] )
+
+    def testValueCache( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-value-cache'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Value Cache Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        self.assertEqual( self.p4.value_cache_size, 0, "Value cache enabled by default")
+        self.assertTrue( 'action' in self.p4.value_cache_fields )
+
+        result = self.p4.run_files('...')
+        self.assertFalse( result[0]['action'] is result[1]['action'] )
+
+        self.p4.value_cache_size = 16
+        self.p4.value_cache_fields = [ 'action', 'type' ]
+        result = self.p4.run_files('...')
+        self.assertTrue( result[0]['action'] is result[1]['action'] )
+        self.assertFalse( result[0]['depotFile'] is result[1]['depotFile'] )
+        self.assertEqual( self.p4.value_cache_stats['misses'], 2, "Unexpected number of cached values")
+
+        with self.assertRaises(TypeError):
+            self.p4.value_cache_fields = 'action'
+
+    def testColumnar( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-columnar'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Columnar Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        rows = self.p4.run_files('...')
+        columns = self.p4.run_files('...', columnar=True)
+        self.assertEqual( self.p4.columnar, 0, "columnar not restored")
+        self.assertEqual( sorted(columns.keys()), sorted(rows[0].keys()) )
+        self.assertEqual( columns['depotFile'], [ x['depotFile'] for x in rows ] )
+
+        # fields missing from some records are filled with None
+        self.p4.run_edit(testDir + "/" + files[0])
+        rows = self.p4.run_fstat('...')
+        columns = self.p4.run_fstat('...', columnar=True)
+        self.assertEqual( len(columns['action']), len(rows) )
+        self.assertEqual( columns['action'], [ x.get('action') for x in rows ] )
+        self.assertEqual( columns['action'].count(None), len(files) - 1 )
+        self.p4.run_revert('...')
+
+    def testLazyRecords( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-lazy-records'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Lazy Records Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        plain = self.p4.run_fstat('...')
+        records = self.p4.run_fstat('...', lazy_records=True)
+        self.assertEqual( self.p4.lazy_records, 0, "lazy_records not restored")
+        self.assertEqual( len(records), len(plain) )
+
+        r = records[0]
+        self.assertTrue( isinstance(r, P4.Record), "Not a P4.Record" )
+        self.assertEqual( r, plain[0] )
+        self.assertEqual( sorted(r.keys()), sorted(plain[0].keys()) )
+        self.assertEqual( r['depotFile'], plain[0]['depotFile'] )
+        self.assertTrue( 'headRev' in r )
+        self.assertFalse( 'action' in r )
+        self.assertEqual( r.get('action', 'none'), 'none' )
+        self.assertEqual( dict(r.items()), plain[0] )
+        self.assertRaises( KeyError, lambda: r['action'] )
+        self.assertRaises( TypeError, r.__setitem__, 'action', 'edit' )
+
+        # indexed fields are still returned as lists
+        logs = self.p4.run_filelog(testDir + "/" + files[0], lazy_records=True)
+        self.assertTrue( isinstance(logs[0], P4.DepotFile) )
+
+    def testTypedFields( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-typed'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Typed Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        plain = self.p4.run_fstat('-Ol', '...')
+        typed = self.p4.run_fstat('-Ol', '...', typed=True)
+        self.assertEqual( self.p4.typed, 0, "typed not restored")
+        self.assertEqual( typed[0]['headRev'], int(plain[0]['headRev']) )
+        self.assertEqual( typed[0]['headTime'], int(plain[0]['headTime']) )
+        self.assertEqual( typed[0]['fileSize'], int(plain[0]['fileSize']) )
+        self.assertEqual( typed[0]['depotFile'], plain[0]['depotFile'] )
+
+        # indexed fields are converted as well; plain run() so that
+        # processFilelog's own int() conversion doesn't hide anything
+        path = testDir + "/" + files[0]
+        self.assertTrue( isinstance(self.p4.run('filelog', path)[0]['rev'][0], str) )
+        log = self.p4.run('filelog', path, typed=True)[0]
+        self.assertTrue( isinstance(log['rev'][0], int) )
+        self.assertTrue( isinstance(log['change'][0], int) )
+        self.assertEqual( log['rev'][0], 1 )
+
+        # schemas can be replaced per command
+        schemas = self.p4.typed_fields
+        self.assertTrue( 'headRev' in schemas['fstat'] )
+        schemas['changes'] = [ 'change' ]
+        self.p4.typed_fields = schemas
+        changes = self.p4.run_changes('-m1', typed=True)
+        self.assertTrue( isinstance(changes[0]['change'], int) )
+        self.assertFalse( isinstance(changes[0]['time'], int) )
+        self.p4.typed_fields = None
+        self.assertTrue( 'time' in self.p4.typed_fields['changes'] )
+
+    def testDiff( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-diff'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Diff Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        for name in files[:2]:
+            path = testDir + "/" + name
+            self.p4.run_edit(path)
+            with open(os.path.join(self.client_root, testDir, name), "w") as f:
+                f.write("Changed Text\nSecond Line\n")
+
+        lines = self.p4.run_diff('...')
+        self.assertTrue( "> Changed Text" in lines )
+        self.assertTrue( "> Second Line" in lines )
+
+        perFile = self.p4.run_diff('...', diff_per_file=True)
+        self.assertEqual( self.p4.diff_per_file, 0, "diff_per_file not restored")
+        diffs = [ x for x in perFile if not isinstance(x, dict) ]
+        self.assertEqual( len(diffs), 2 )
+        self.assertEqual( "".join(diffs).splitlines(),
+                          [ x for x in lines if not isinstance(x, dict) ] )
+        self.p4.run_revert('...')
+
+    def testPrint( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-print'
+        testAbsoluteDir = os.path.join(self.client_root, testDir)
+        os.mkdir(testAbsoluteDir)
+
+        # larger than a single chunk, empty, and binary contents
+        contents = { 'large.txt' : "0123456789abcdef\n" * 10000,
+                     'empty.txt' : "",
+                     'data.bin'  : b"\x00\x01\x02" * 1000 }
+        for name, data in contents.items():
+            mode = "wb" if isinstance(data, bytes) else "w"
+            with open(os.path.join(testAbsoluteDir, name), mode) as f:
+                f.write(data)
+            self.p4.run_add("-t", "binary" if mode == "wb" else "text",
+                            testDir + "/" + name)
+
+        change = self.p4.fetch_change()
+        change._description = "My Print Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        result = self.p4.run_print(testDir + '/...')
+        self.assertEqual( self.p4.assemble_print, 0, "assemble_print not restored")
+        self.assertEqual( len(result), 2 * len(contents) )
+        for header, data in zip(result[0::2], result[1::2]):
+            name = header['depotFile'].split('/')[-1]
+            self.assertEqual( data, contents[name] )
+
+        # without headers the contents still come back as one string
+        result = self.p4.run_print('-q', testDir + '/large.txt')
+        self.assertEqual( result, [ contents['large.txt'] ] )
+
+    def testPrintTo( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-print-to'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Print To Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        target = os.path.join(self.server_root, "print-target")
+        headers = self.p4.print_to(target, testDir + '/...')
+        self.assertEqual( self.p4.print_target, None, "print_target not restored")
+        self.assertEqual( len(headers), len(files) )
+
+        for h in headers:
+            self.assertTrue( isinstance(h, dict), "Expected only headers" )
+            local = os.path.join(target, h['depotFile'][2:])
+            contents = self.p4.run_print(h['depotFile'])[1]
+            with open(local) as f:
+                self.assertEqual( f.read(), contents )
+
+        # a dict target only redirects the files it names
+        depotFile = headers[0]['depotFile']
+        local = os.path.join(self.server_root, "print-single")
+        result = self.p4.print_to({ depotFile : local }, testDir + '/...')
+        self.assertTrue( os.path.exists(local) )
+        self.assertEqual( len(result), 2 * len(files) - 1 )
+
+        # only print writes to the target
+        other = os.path.join(self.server_root, "print-other")
+        self.p4.print_target = other
+        try:
+            self.assertEqual( len(self.p4.run_files(testDir + '/...')), len(files) )
+        finally:
+            self.p4.print_target = None
+        self.assertFalse( os.path.exists(other) )
+
+    def testOutputHandlerBatch( self ):
+        self.p4.connect()
+        self._setClient()
+
+        class MyBatchHandler(P4.OutputHandler):
+            batch_size = 2
+
+            def __init__(self):
+                P4.OutputHandler.__init__(self)
+                self.batches = []
+
+            def outputStatBatch(self, stats):
+                self.batches.append(stats)
+                return P4.OutputHandler.HANDLED
+
+        testDir = 'test-batch-handler'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Batch Handler Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        h = MyBatchHandler()
+        with self.p4.using_handler(h):
+            self.assertEqual( len(self.p4.run_files('...')), 0, "p4 does not return empty list")
+        self.assertEqual( [ len(b) for b in h.batches ], [ 2, 1 ], "Unexpected batches")
+
+        # the default batch method reports each record through outputStat
+        h = P4.OutputHandler()
+        h.batch_size = 10
+        with self.p4.using_handler(h):
+            self.assertEqual( len(self.p4.run_files('...')), len(files), "Records not reported")
+
+        # a CANCEL in a list of answers stops at that record
+        class CancelHandler(P4.OutputHandler):
+            batch_size = len(files)
+
+            def outputStatBatch(self, stats):
+                answers = [ P4.OutputHandler.REPORT ] * len(stats)
+                answers[1] = P4.OutputHandler.CANCEL
+                return answers
+
+        with self.p4.using_handler(CancelHandler()):
+            self.assertEqual( len(self.p4.run_files('...')), 2, "Records after CANCEL reported")
+
+    def testRunIter( self ):
+        self.p4.connect()
+        self._setClient()
+
+        testDir = 'test-iter'
+        files = self.createFiles(testDir)
+
+        change = self.p4.fetch_change()
+        change._description = "My Iterator Test"
+
+        self._doSubmit("Failed to submit the add", change)
+
+        # a buffer smaller than the result forces the server thread to wait
+        result = self.p4.run_iter('files', '...', iter_buffer=1)
+        self.assertEqual( self.p4.iter_buffer, 1, "iter_buffer restored while streaming")
+        depotFiles = [ x['depotFile'] for x in result ]
+        self.assertEqual( self.p4.iter_buffer, 1000, "iter_buffer not restored")
+        self.assertEqual( depotFiles, [ x['depotFile'] for x in self.p4.run_files('...') ] )
+
+        result = self.p4.run('files', '...', iterate=True)
+        self.assertEqual( len(list(result)), len(files), "Unexpected number of files")
+
+        # abandoning an iterator must leave the connection usable
+        result = self.p4.run_iter('files', '...')
+        next(result)
+        result.close()
+        self.assertEqual( len(self.p4.run_files('...')), len(files), "Connection unusable after close")
+
+        # errors are raised once the iterator is exhausted
+        with self.assertRaises(P4.P4Exception):
+            list(self.p4.run_iter('files', '//depot/no-such-dir/...'))
+        self.assertEqual( len(self.p4.run_files('...')), len(files), "Connection unusable after error")
+
+        # per-call settings apply until the streamed command has finished
+        self.assertEqual( list(self.p4.run_iter('files', '//depot/no-such-dir/...', exception_level=0)), [] )
+        self.assertEqual( self.p4.exception_level, 2, "exception_level not restored")
+
     def testProgress( self ):
         self.p4.connect()
         self._setClient()
@@ -1306,6 +2171,28 @@ class TestP4(TestP4Python):
 
         self.assertEqual(len(group_names), len(set(group_names)), "iterate_groups returned duplicate groups")
 
+    def testIterateWindow( self ):
+        self.p4.connect()
+
+        for i in range(5):
+            c = self.p4.fetch_client('window%d' % i)
+            self.p4.save_client(c)
+
+        names = [ c['client'] for c in self.p4.run_clients() ]
+        expected = [ self.p4.fetch_client(n) for n in names ]
+
+        for window in (1, 2, len(names), 100):
+            specs = list(self.p4.iterate_clients(window=window))
+            self.assertEqual( [ s._client for s in specs ], names )
+            self.assertEqual( specs, expected )
+            self.assertTrue( isinstance(specs[0], P4.Spec), "Not a P4.Spec" )
+
+        # a partly consumed iteration leaves the connection usable
+        it = self.p4.iterate_clients(window=2)
+        self.assertEqual( next(it)._client, names[0] )
+        it.close()
+        self.assertEqual( self.p4.fetch_client(names[1]), expected[1] )
+
     # P4.encoding is only available (and undoc'd) in Python 3
     # Something in Python 3.7 prevents writing filenames that aren't valid UTF8
 
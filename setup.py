@@ -6,13 +6,14 @@ Perforce C++ API to gain performance and ease of coding.
 Similar to interfaces available for Ruby and Perl.
 
 """
-from __future__ import print_function
 
 classifiers = """\
 Development Status :: 5 - Production/Stable
 Intended Audience :: Developers
 License :: Freely Distributable
 Programming Language :: Python
+Programming Language :: Python :: 3
+Programming Language :: Python :: 3 :: Only
 Topic :: Software Development :: Libraries :: Python Modules
 Topic :: Software Development :: Version Control
 Topic :: Software Development
@@ -47,10 +48,7 @@ from tools.PlatformInfo import PlatformInfo
 from tools.VersionInfo import VersionInfo
 from tools.P4APIHttps import P4APIHttps
 
-if sys.version_info < (3, 0):
-    from ConfigParser import ConfigParser
-else:
-    from configparser import ConfigParser
+from configparser import ConfigParser
 
 global_dist_directory = "p4python-"
 
@@ -59,6 +57,9 @@ doclines = __doc__.split("\n")
 NAME = "p4python"
 VERSION = "2023.1"
 PY_MODULES = ["P4"]
+# P4API uses multi-phase init and heap types (PyType_FromModuleAndSpec,
+# PyModule_AddType), see P4API_exec
+PYTHON_REQUIRES = ">=3.10"
 P4_API_DIR = "p4api"
 DESCRIPTION = doclines[0]
 AUTHOR = "Perforce Software Inc"
@@ -449,7 +450,7 @@ def do_setup():
 
     p4_extension = Extension("P4API", ["P4API.cpp", "PythonClientAPI.cpp",
                                            "PythonClientUser.cpp", "SpecMgr.cpp",
-                                           "P4Result.cpp",
+                                           "P4Result.cpp", "P4ConnectionPool.cpp", "P4CommandBatch.cpp", "P4ResultQueue.cpp", "P4StatArena.cpp", "P4TrackStats.cpp", "PythonRecord.cpp",
                                            "PythonMergeData.cpp", "P4MapMaker.cpp",
                                            "PythonSpecData.cpp", "PythonMessage.cpp",
                                            "PythonActionMergeData.cpp", "PythonClientProgress.cpp",
@@ -474,6 +475,7 @@ def do_setup():
           keywords=KEYWORDS,
           classifiers=[x for x in classifiers.split("\n") if x],
           long_description="\n".join(doclines[2:]),
+          python_requires=PYTHON_REQUIRES,
           py_modules=PY_MODULES,
           ext_modules=[p4_extension],
           cmdclass={